@@ -50,6 +50,7 @@
 	#define HEADER_L   1
 	#define MIN_L	   1
 	#define CMD_L      64
+	#define KISS_PORTS 1
 
     bool mw_radio_online = false;
 
@@ -74,10 +75,38 @@
 	#define LORA_PREAMBLE_SYMBOLS_MIN 18
 	#define LORA_PREAMBLE_TARGET_MS   15
 	#define LORA_CAD_SYMBOLS 3
-	int csma_slot_ms = 50;
+	// The slot derived from the symbol time and
+	// exponential backoff are opt-in, see the
+	// simulation in Tests/csma_sim.cpp
+	#define CSMA_SLOT_DEFAULT_MS 50
+	int csma_slot_ms = CSMA_SLOT_DEFAULT_MS;
+	#define CSMA_SLOT_SYMBOLS 10
+	#define CSMA_SLOT_MIN_MS  5
+	#define CSMA_SLOT_MAX_MS  1000
+	#define CSMA_BE_LIMIT     10
+	uint16_t csma_slot_fixed_ms = CSMA_SLOT_DEFAULT_MS;
+	uint32_t csma_cad_us = 0;
+	uint8_t csma_be_min = 0;
+	uint8_t csma_be_max = 0;
+	uint8_t csma_be = 0;
 	float csma_p_min = 0.1;
 	float csma_p_max = 0.8;
 	uint8_t csma_p = 0;
+	uint8_t csma_curve_slope = 100;
+	bool cad_lbt = false;
+
+	// Duty-cycled receive
+	#define RX_DUTY_IDLE_MS 10
+	bool rx_duty = false;
+	bool rx_duty_hw = false;
+	uint16_t rx_duty_rx_ms = 0;
+	uint16_t rx_duty_sleep_ms = 0;
+	// Sleep and listen period of the receivers
+	// this node sends to, which the preamble
+	// has to span even if it never sleeps itself
+	uint16_t tx_wake_ms = 0;
+	uint32_t sniff_next = 0;
+	uint32_t sniff_rx_until = 0;
 
 	int  lora_sf   	           = 0;
 	int  lora_cr               = 5;
@@ -86,9 +115,13 @@
 	uint32_t lora_freq         = 0;
 	uint32_t lora_bitrate      = 0;
 	long lora_preamble_symbols = 6;
-	float lora_symbol_time_ms  = 0.0;
-	float lora_symbol_rate     = 0.0;
-	float lora_us_per_byte     = 0.0;
+	uint32_t lora_symbol_time_ns = 0;
+	uint32_t lora_byte_time_ns   = 0;
+	uint32_t lora_overhead_us    = 0;
+	uint8_t  lora_modulation     = MODULATION_LORA;
+	#define SYNC_WORD_DEFAULT    0x12
+	uint8_t  lora_sync_word      = SYNC_WORD_DEFAULT;
+	uint16_t lora_frame_mtu      = SINGLE_MTU;
 
 	// Operational variables
 	bool radio_locked  = true;
@@ -99,6 +132,7 @@
 	bool disp_ready    = false;
 	bool pmu_ready     = false;
 	bool promisc       = false;
+	bool rx_meta       = false;
 	bool implicit      = false;
 	uint8_t implicit_l = 0;
 
@@ -110,11 +144,33 @@
 	int		last_rssi		= -292;
 	uint8_t last_rssi_raw   = 0x00;
 	uint8_t last_snr_raw	= 0x80;
+	uint32_t last_tx_us     = 0;
 	uint8_t seq				= 0xFF;
-	uint16_t read_len		= 0;
+	uint8_t seq_next        = 0;
+
+	// Incoming packet buffers. Packets are
+	// assembled in the head slot, and handed
+	// over to the host writer once complete.
+	typedef struct {
+		int      rssi;
+		uint8_t  snr_raw;
+		int32_t  freq_error;
+		uint32_t rx_us;
+		uint8_t  frags;
+		uint16_t len;
+		uint8_t  data[MTU];
+	} rx_packet_t;
 
-	// Incoming packet buffer
-	uint8_t pbuf[MTU];
+	#if MCU_VARIANT == MCU_ESP32 || MCU_VARIANT == MCU_NRF52
+		#define RX_POOL_SLOTS 4
+	#else
+		#define RX_POOL_SLOTS 1
+	#endif
+	rx_packet_t rx_pool[RX_POOL_SLOTS];
+	volatile uint8_t rx_pool_head = 0;
+	volatile uint8_t rx_pool_tail = 0;
+	uint32_t rx_pool_overflows    = 0;
+	uint8_t rx_pool_peak          = 0;
 
 	// KISS command buffer
 	uint8_t cmdbuf[CMD_L];
@@ -144,6 +200,140 @@
 		float airtime = 0.0;
 		float longterm_airtime = 0.0;
 		#define current_airtime_bin(void) (millis()%AIRTIME_LONGTERM_MS)/AIRTIME_BINLEN_MS
+
+		// Scheduled transmission
+		#define SCHED_LEAD_US    50000
+		#define SCHED_PRELOAD_US 2000
+		#define SCHED_LATE_US    1000
+		#define SCHED_SPIN_US    300
+		#define SCHED_TICK_US    (portTICK_PERIOD_MS*1000)
+		uint8_t sched_buf[SINGLE_MTU];
+		uint16_t sched_len = 0;
+		uint32_t sched_at = 0;
+		volatile bool sched_pending = false;
+		bool sched_dropped = false;
+
+		// Per-station statistics in promiscuous
+		// mode, keyed by a range of header bytes
+		#define STATION_SLOTS   16
+		#define STATION_KEY_MAX 8
+		typedef struct {
+			bool     used;
+			uint8_t  key[STATION_KEY_MAX];
+			uint32_t packets;
+			uint32_t airtime_us;
+			int      rssi;
+			uint8_t  snr_raw;
+			uint32_t last_seen;
+		} station_t;
+		station_t stations[STATION_SLOTS];
+		uint8_t station_key_offset = 0;
+		uint8_t station_key_len = 0;
+
+		// Receive filter on a range of header
+		// bytes, such as a destination prefix
+		#define RX_FILTER_SLOTS   8
+		#define RX_FILTER_KEY_MAX 6
+		uint8_t rx_filter[RX_FILTER_SLOTS][RX_FILTER_KEY_MAX];
+		uint8_t rx_filter_count = 0;
+		uint8_t rx_filter_offset = 0;
+		uint8_t rx_filter_len = 0;
+		uint32_t rx_filtered = 0;
+
+		// Stored radio profiles for fast switching
+		#define PROFILE_SLOTS 4
+		#define PROFILE_NONE  0xFF
+		#if MODEM == SX1280
+			#define PROFILE_FREQ_MIN 2400000000
+			#define PROFILE_FREQ_MAX 2500000000
+			#define PROFILE_BW_MIN   203125
+			#define PROFILE_BW_MAX   1625000
+		#else
+			#define PROFILE_FREQ_MIN 137000000
+			#define PROFILE_FREQ_MAX 1020000000
+			#define PROFILE_BW_MIN   7800
+			#define PROFILE_BW_MAX   500000
+		#endif
+		typedef struct {
+			bool     used;
+			uint32_t freq;
+			uint32_t bw;
+			uint8_t  sf;
+			uint8_t  cr;
+			uint8_t  txp;
+			uint8_t  sync_word;
+		} radio_profile_t;
+		radio_profile_t profiles[PROFILE_SLOTS];
+		uint8_t profile_active = PROFILE_NONE;
+
+		// Frequency hopping over a table set by
+		// the host, in time slots of hop_dwell_ms
+		#define HOP_MAX             14
+		#define HOP_HEADER_L        3
+		#define HOP_DWELL_MIN_MS    20
+		#define HOP_SYNC_TIMEOUT_MS 30000
+		uint8_t  hop_count = 0;
+		uint32_t hop_freqs[HOP_MAX];
+		uint8_t  hop_order[HOP_MAX];
+		uint32_t hop_airtime_ms[HOP_MAX];
+		uint16_t hop_dwell_ms = 0;
+		uint16_t hop_seed = 0;
+		uint8_t  hop_index = 0;
+		uint32_t hop_tx_slot = 0;
+		volatile uint32_t hop_epoch = 0;
+		volatile uint32_t hop_sync_until = 0;
+		volatile bool hop_synced = false;
+
+		// A new table from the host is staged here,
+		// and swapped in by the main loop while it
+		// holds the modem lock
+		uint32_t hop_next_freqs[HOP_MAX];
+		uint8_t  hop_next_count = 0;
+		uint16_t hop_next_dwell_ms = 0;
+		uint16_t hop_next_seed = 0;
+		volatile bool hop_reload = false;
+
+		// Channel scanner
+		#define SCAN_MAX_CHANNELS 64
+		#define SCAN_SAMPLE_US    1000
+		bool scan_active = false;
+		volatile bool scan_requested = false;
+		uint32_t scan_start = 0;
+		uint32_t scan_step = 0;
+		uint32_t scan_bw = 0;
+		uint8_t scan_count = 0;
+		uint8_t scan_index = 0;
+		uint16_t scan_dwell_ms = 0;
+		uint32_t scan_until = 0;
+		uint32_t scan_next_sample = 0;
+		uint8_t scan_floor[SCAN_MAX_CHANNELS];
+		uint8_t scan_peak[SCAN_MAX_CHANNELS];
+		uint32_t scan_sum[SCAN_MAX_CHANNELS];
+		uint16_t scan_samples[SCAN_MAX_CHANNELS];
+		uint32_t *scan_list = NULL;
+		bool scan_autochan = false;
+
+		// Automatic channel selection
+		#define AUTOCHAN_OFF         0x00
+		#define AUTOCHAN_PROPOSE     0x01
+		#define AUTOCHAN_MOVE        0x02
+		#define AUTOCHAN_MAX         15
+		#define AUTOCHAN_DWELL_MS    250
+		#define AUTOCHAN_INTERVAL_MS 600000
+		#define AUTOCHAN_SWITCH_MS   2000
+		#define AUTOCHAN_HYST        6
+		#define AUTOCHAN_UTIL_WEIGHT 20
+		uint8_t autochan_mode = AUTOCHAN_OFF;
+		uint8_t autochan_count = 0;
+		uint8_t autochan_interval_min = 0;
+		uint32_t autochan_freqs[AUTOCHAN_MAX];
+		float autochan_util[AUTOCHAN_MAX];
+		uint8_t autochan_score[AUTOCHAN_MAX];
+		uint8_t autochan_best = 0;
+		uint32_t autochan_next = 0;
+		bool autochan_switch_pending = false;
+		uint32_t autochan_switch_freq = 0;
+		uint32_t autochan_switch_at = 0;
 	#endif
 	float st_airtime_limit = 0.0;
 	float lt_airtime_limit = 0.0;
@@ -159,6 +349,13 @@
 	uint16_t dcd_count          = 0;
 	uint16_t dcd_threshold      = 2;
 
+	// Pre-transmit carrier sense state
+	#define CSMA_IDLE    0x00
+	#define CSMA_SENSING 0x01
+	uint8_t csma_state          = CSMA_IDLE;
+	uint8_t csma_samples        = 0;
+	uint32_t csma_next_sample   = 0;
+
 	uint32_t status_interval_ms = STATUS_INTERVAL_MS;
 	uint32_t last_status_update = 0;
 	uint32_t last_dcd = 0;
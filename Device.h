@@ -42,6 +42,8 @@
 
 // Forward declaration from Utilities.h
 void eeprom_update(int mapped_addr, uint8_t byte);
+void eeprom_batch_begin();
+void eeprom_batch_commit();
 uint8_t eeprom_read(uint32_t addr);
 void hard_reset(void);
 
@@ -104,9 +106,11 @@ void device_validate_signature() {
 void device_save_signature() {
   device_validate_signature();
   if (dev_signature_validated) {
+    eeprom_batch_begin();
     for (uint8_t i = 0; i < DEV_SIG_LEN; i++) {
       eeprom_update(dev_sig_addr(i), dev_sig[i]);
     }
+    eeprom_batch_commit();
   }
 }
 
@@ -131,12 +135,11 @@ void device_load_firmware_hash() {
 }
 
 void device_save_firmware_hash() {
+  eeprom_batch_begin();
   for (uint8_t i = 0; i < DEV_HASH_LEN; i++) {
     eeprom_update(dev_fwhash_addr(i), dev_firmware_hash_target[i]);
   }
-  #if !HAS_EEPROM && MCU_VARIANT == MCU_NRF52
-    eeprom_flush();
-  #endif
+  eeprom_batch_commit();
   if (!fw_signature_validated) hard_reset();
 }
 
@@ -35,6 +35,7 @@
   #define CMD_LEAVE       0x0A
   #define CMD_ST_ALOCK    0x0B
   #define CMD_LT_ALOCK    0x0C
+  #define CMD_RX_META     0x0D
   #define CMD_PROMISC     0x0E
   #define CMD_READY       0x0F
 
@@ -45,7 +46,28 @@
   #define CMD_STAT_CHTM   0x25
   #define CMD_STAT_PHYPRM 0x26
   #define CMD_STAT_BAT    0x27
+  #define CMD_DATA_META   0x28
+  #define CMD_STAT_TIME   0x29
+  #define CMD_STAT_TXTS   0x2A
+  #define CMD_STAT_RXPOOL 0x2B
+  #define CMD_STAT_STATIONS 0x2C
+  #define CMD_STAT_SPECTRUM 0x2D
+  #define CMD_STAT_CHAN   0x2E
   #define CMD_BLINK       0x30
+  #define CMD_DATA_AT     0x31
+  #define CMD_LBT         0x32
+  #define CMD_RX_DUTY     0x33
+  #define CMD_CSMA_PARAMS 0x34
+  #define CMD_CSMA_CURVE  0x35
+  #define CMD_STATIONS    0x36
+  #define CMD_SCAN        0x37
+  #define CMD_AUTOCHAN    0x38
+  #define CMD_MODULATION  0x39
+  #define CMD_SYNC_WORD   0x3A
+  #define CMD_RX_FILTER   0x3B
+  #define CMD_PROFILE     0x3C
+  #define CMD_HOP         0x3D
+  #define CMD_TX_WAKE     0x3E
   #define CMD_RANDOM      0x40
 
   #define CMD_FB_EXT      0x41
@@ -84,13 +106,33 @@
   #define NIBBLE_SEQ      0xF0
   #define NIBBLE_FLAGS    0x0F
   #define FLAG_SPLIT      0x01
+  #define FLAG_SPLIT_MORE 0x02
+  #define FLAG_HOP        0x04
+  #define FLAG_BEACON     0x08
+  #define BEACON_MAGIC_1  0x43
+  #define BEACON_MAGIC_2  0x48
+  #define BEACON_L        8
   #define SEQ_UNSET       0xFF
+  #define SPLIT_INDEX_L   1
+
+  // Multi-port KISS hosts put a port number
+  // in the high nibble of data frames. Only
+  // port 0 is served, data for ports 1 and 2
+  // is rejected with ERROR_PORT. From port 3
+  // up the byte is CMD_BLINK and later
+  // commands, so it is never a data frame.
+  #define NIBBLE_PORT     0xF0
+  #define NIBBLE_CMD      0x0F
+  #define KISS_PORTS_MAX  3
 
   #define CMD_ERROR           0x90
   #define ERROR_INITRADIO     0x01
   #define ERROR_TXFAILED      0x02
   #define ERROR_EEPROM_LOCKED 0x03
   #define ERROR_QUEUE_FULL    0x04
+  #define ERROR_SCHED_MISSED  0x05
+  #define ERROR_SCAN          0x06
+  #define ERROR_PORT          0x07
 
   // Serial framing variables
   size_t frame_len;
@@ -1,4 +1,32 @@
+#ifndef MODEM_H
+#define MODEM_H
+
+#include <stdint.h>
+
 #define SX1276 0x01
 #define SX1278 0x02
 #define SX1262 0x03
 #define SX1280 0x04
+
+// Modems of one type that can be attached
+// to interrupts at the same time
+#define MODEM_INSTANCES 2
+
+#define MODULATION_LORA 0x00
+#define MODULATION_GFSK 0x01
+#define MODULATION_FLRC 0x02
+
+// Complete radio configuration, so drivers
+// can write every parameter to the modem once
+typedef struct {
+  uint32_t frequency;
+  uint32_t bandwidth;
+  uint8_t  sf;
+  uint8_t  cr;
+  uint8_t  modulation;
+  int      txp;
+  int      txp_pin; // -1 leaves the TX power as is
+  long     preamble;
+} RadioConfig;
+
+#endif
@@ -0,0 +1,52 @@
+// Copyright (C) 2023, Mark Qvist
+
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#ifndef PHY_H
+  #define PHY_H
+
+  #include <stdint.h>
+
+  #define PHY_HEADER_LORA_SYMBOLS 8
+  // Preamble, sync word, length and CRC
+  #define PHY_OVERHEAD_FSK_BYTES  11
+
+  // Integer PHY model. Times are kept in ns,
+  // and 2^SF is applied as a shift.
+  uint32_t phy_symbol_time_ns(uint8_t sf, uint32_t bw) {
+    return (uint32_t)(((uint64_t)1000000000 << sf) / bw);
+  }
+
+  uint32_t phy_byte_time_ns(uint8_t sf, uint8_t cr, uint32_t bw) {
+    // 8 bits at sf*(4/cr) bits per symbol
+    return (uint32_t)((((uint64_t)2000000000*cr) << sf) / ((uint32_t)sf*bw));
+  }
+
+  uint32_t phy_bitrate(uint8_t sf, uint8_t cr, uint32_t bw) {
+    return ((uint32_t)sf*4*bw/cr) >> sf;
+  }
+
+  uint32_t phy_overhead_us(uint32_t preamble_symbols, uint32_t symbol_time_ns) {
+    // Preamble, 4.25 sync symbols and the PHY header,
+    // saturating for very long preambles at low rates
+    uint64_t quarter_symbols = (uint64_t)preamble_symbols*4 + 17 + PHY_HEADER_LORA_SYMBOLS*4;
+    uint64_t overhead_us = (quarter_symbols*symbol_time_ns) / 4000;
+    return overhead_us > 0xFFFFFFFF ? 0xFFFFFFFF : (uint32_t)overhead_us;
+  }
+
+  uint32_t phy_overhead_fsk_us(uint32_t byte_time_ns) {
+    return (uint32_t)(((uint64_t)PHY_OVERHEAD_FSK_BYTES*byte_time_ns) / 1000);
+  }
+
+#endif
@@ -67,6 +67,7 @@ class KISS():
     ERROR_INITRADIO     = 0x01
     ERROR_TXFAILED      = 0x02
     ERROR_EEPROM_LOCKED = 0x03
+    ERROR_PORT          = 0x07
 
     @staticmethod
     def escape(data):
@@ -479,6 +480,8 @@ class RNodeInterface():
                                 self.log(str(self)+" hardware initialisation error (code "+RNS.hexrep(byte)+")", RNodeInterface.LOG_ERROR)
                             elif (byte == KISS.ERROR_INITRADIO):
                                 self.log(str(self)+" hardware TX error (code "+RNS.hexrep(byte)+")", RNodeInterface.LOG_ERROR)
+                            elif (byte == KISS.ERROR_PORT):
+                                self.log(str(self)+" data frame for an unsupported KISS port (code "+RNS.hexrep(byte)+")", RNodeInterface.LOG_ERROR)
                             else:
                                 self.log(str(self)+" hardware error (code "+RNS.hexrep(byte)+")", RNodeInterface.LOG_ERROR)
                         elif (command == KISS.CMD_READY):
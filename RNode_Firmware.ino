@@ -43,8 +43,43 @@ volatile bool serial_buffering = false;
 
 char sbuf[128];
 
+#if MCU_VARIANT == MCU_ESP32
+  // On ESP32, the MAC runs in loop() on the
+  // application core, while host I/O, display
+  // and Bluetooth run in the host task on the
+  // protocol core. The short queue counter and
+  // event updates between them use mac_lock.
+  #define HOST_TASK_PRIORITY 1
+  #define HOST_TASK_CORE     0
+  TaskHandle_t host_task_handle = NULL;
+  portMUX_TYPE mac_lock = portMUX_INITIALIZER_UNLOCKED;
+#endif
+
+// Host indications raised by the MAC
+#define MAC_EVT_TXTS         0x01
+#define MAC_EVT_TXFAILED     0x02
+#define MAC_EVT_SCHED_MISSED 0x04
+#define MAC_EVT_SPECTRUM     0x08
+#define MAC_EVT_CHAN         0x10
+#define MAC_EVT_FREQ         0x20
+#define MAC_EVT_CHTM         0x40
+#define MAC_EVT_HOP          0x80
+volatile uint8_t mac_events = 0x00;
+
 #if MCU_VARIANT == MCU_ESP32 || MCU_VARIANT == MCU_NRF52
-  bool packet_ready = false;
+  // On ESP32 and nRF52, the DIO ISR only notifies
+  // the radio task. All modem SPI access is then
+  // serialised by the recursive modem lock.
+  #define RADIO_TASK_PRIORITY (configMAX_PRIORITIES-1)
+  TaskHandle_t radio_task_handle = NULL;
+  TaskHandle_t sched_task_handle = NULL;
+  SemaphoreHandle_t modem_lock = NULL;
+
+  inline void modem_lock_take() { xSemaphoreTakeRecursive(modem_lock, portMAX_DELAY); }
+  inline void modem_lock_give() { xSemaphoreGiveRecursive(modem_lock); }
+#else
+  inline void modem_lock_take() { }
+  inline void modem_lock_give() { }
 #endif
 
 void setup() {
@@ -60,6 +95,10 @@ void setup() {
     }
   #endif
 
+  #if MCU_VARIANT == MCU_ESP32 || MCU_VARIANT == MCU_NRF52
+    radio_task_start();
+  #endif
+
   // Seed the PRNG for CSMA R-value selection
   # if MCU_VARIANT == MCU_ESP32
     // On ESP32, get the seed value from the
@@ -106,7 +145,7 @@ void setup() {
   #endif
 
   // Initialise buffers
-  memset(pbuf, 0, sizeof(pbuf));
+  memset(rx_pool, 0, sizeof(rx_pool));
   memset(cmdbuf, 0, sizeof(cmdbuf));
   
   memset(packet_queue, 0, sizeof(packet_queue));
@@ -163,8 +202,10 @@ void setup() {
     #elif MCU_VARIANT == MCU_NRF52
     if (eeprom_read(eeprom_addr(ADDR_CONF_DSET)) != CONF_OK_BYTE) {
     #endif
+      eeprom_batch_begin();
       eeprom_update(eeprom_addr(ADDR_CONF_DSET), CONF_OK_BYTE);
       eeprom_update(eeprom_addr(ADDR_CONF_DINT), 0xFF);
+      eeprom_batch_commit();
     }
     disp_ready = display_init();
     update_display();
@@ -195,39 +236,200 @@ void setup() {
   validate_status();
 
   if (op_mode != MODE_TNC) LoRa->setFrequency(0);
+
+  #if MCU_VARIANT == MCU_ESP32
+    host_task_start();
+  #endif
 }
 
 void lora_receive() {
-  if (!implicit) {
-    LoRa->receive();
-  } else {
-    LoRa->receive(implicit_l);
+  modem_lock_take();
+  if (rx_duty) {
+    rx_duty_hw = LoRa->receiveDutyCycle((uint32_t)rx_duty_rx_ms*1000, (uint32_t)rx_duty_sleep_ms*1000, implicit ? implicit_l : 0);
   }
+
+  if (!rx_duty || !rx_duty_hw) {
+    if (!implicit) {
+      LoRa->receive();
+    } else {
+      LoRa->receive(implicit_l);
+    }
+  }
+  modem_lock_give();
 }
 
-inline void kiss_write_packet() {
-  serial_write(FEND);
-  serial_write(CMD_DATA);
-  for (uint16_t i = 0; i < read_len; i++) {
-    uint8_t byte = pbuf[i];
+inline void kiss_write_packet(rx_packet_t *pkt) {
+  last_rssi = pkt->rssi;
+  last_snr_raw = pkt->snr_raw;
+
+  if (!rx_meta) {
+    // We first signal the RSSI and SNR of
+    // the recieved packet to the host.
+    kiss_indicate_stat_rssi();
+    kiss_indicate_stat_snr();
+
+    serial_write(FEND);
+    serial_write(CMD_DATA);
+  } else {
+    // With extended RX frames enabled, the
+    // packet metadata is prepended to the
+    // payload, all in a single frame.
+    uint8_t packet_rssi_val = (uint8_t)(pkt->rssi+rssi_offset);
+    serial_write(FEND);
+    serial_write(CMD_DATA_META);
+    escaped_serial_write(packet_rssi_val);
+    escaped_serial_write(pkt->snr_raw);
+    escaped_serial_write(pkt->freq_error>>24);
+    escaped_serial_write(pkt->freq_error>>16);
+    escaped_serial_write(pkt->freq_error>>8);
+    escaped_serial_write(pkt->freq_error);
+    escaped_serial_write(pkt->rx_us>>24);
+    escaped_serial_write(pkt->rx_us>>16);
+    escaped_serial_write(pkt->rx_us>>8);
+    escaped_serial_write(pkt->rx_us);
+    escaped_serial_write(pkt->frags);
+  }
+  for (uint16_t i = 0; i < pkt->len; i++) {
+    uint8_t byte = pkt->data[i];
     if (byte == FEND) { serial_write(FESC); byte = TFEND; }
     if (byte == FESC) { serial_write(FESC); byte = TFESC; }
     serial_write(byte);
   }
   serial_write(FEND);
-  read_len = 0;
+  pkt->len = 0;
+}
+
+inline bool rx_pool_empty() {
+  return rx_pool_head == rx_pool_tail;
+}
+
+inline void rx_pool_push() {
   #if MCU_VARIANT == MCU_ESP32 || MCU_VARIANT == MCU_NRF52
-    packet_ready = false;
+    uint8_t next = (rx_pool_head+1)%RX_POOL_SLOTS;
+    if (next == rx_pool_tail) {
+      // All slots are waiting for the host, so
+      // the packet is dropped and the head slot
+      // reused for the next one
+      rx_pool_overflows++;
+      rx_pool[rx_pool_head].len = 0;
+    } else {
+      // Make sure the slot contents are visible
+      // before the slot is handed over
+      __sync_synchronize();
+      rx_pool_head = next;
+
+      uint8_t depth = (rx_pool_head+RX_POOL_SLOTS-rx_pool_tail)%RX_POOL_SLOTS;
+      if (depth > rx_pool_peak) rx_pool_peak = depth;
+    }
+  #else
+    // Write the entire packet to the host
+    kiss_write_packet(&rx_pool[0]);
   #endif
 }
 
-inline void getPacketData(uint16_t len) {
-  while (len-- && read_len < MTU) {
-    pbuf[read_len++] = LoRa->read();
+#if MCU_VARIANT == MCU_ESP32 || MCU_VARIANT == MCU_NRF52
+  void rx_pool_drain() {
+    while (!rx_pool_empty()) {
+      kiss_write_packet(&rx_pool[rx_pool_tail]);
+      __sync_synchronize();
+      rx_pool_tail = (rx_pool_tail+1)%RX_POOL_SLOTS;
+    }
+  }
+#endif
+
+inline void getPacketData(rx_packet_t *pkt, uint16_t len) {
+  while (len-- && pkt->len < MTU) {
+    pkt->data[pkt->len++] = LoRa->read();
   }
 }
 
+#if MCU_VARIANT == MCU_ESP32 || MCU_VARIANT == MCU_NRF52
+  void stations_reset() {
+    memset(stations, 0, sizeof(stations));
+  }
+
+  bool rx_filter_match(rx_packet_t *pkt) {
+    // Without any entries, everything passes
+    if (rx_filter_count == 0) return true;
+    if (pkt->len >= rx_filter_offset+rx_filter_len) {
+      uint8_t *key = &pkt->data[rx_filter_offset];
+      for (uint8_t i = 0; i < rx_filter_count; i++) {
+        if (memcmp(rx_filter[i], key, rx_filter_len) == 0) return true;
+      }
+    }
+    rx_filtered++;
+    return false;
+  }
+
+  bool profile_select(uint8_t index) {
+    if (index >= PROFILE_SLOTS || !profiles[index].used) return false;
+
+    radio_profile_t *p = &profiles[index];
+    lora_freq = p->freq;
+    lora_bw = p->bw;
+    lora_sf = p->sf;
+    lora_cr = p->cr;
+    lora_txp = p->txp;
+    lora_sync_word = p->sync_word;
+    profile_active = index;
+
+    if (radio_online) {
+      modem_lock_take();
+      applyRadioConfig();
+      setSyncWord();
+      lora_receive();
+      modem_lock_give();
+    }
+    return true;
+  }
+
+  void station_record(rx_packet_t *pkt) {
+    if (station_key_len == 0 || pkt->len < station_key_offset+station_key_len) return;
+    uint8_t *key = &pkt->data[station_key_offset];
+
+    // Open addressing on a small hash of the key.
+    // When the table is full, the station seen
+    // least recently is replaced.
+    uint8_t h = 0;
+    for (uint8_t k = 0; k < station_key_len; k++) h = (h*31)+key[k];
+
+    station_t *st = NULL;
+    station_t *oldest = NULL;
+    for (uint8_t i = 0; i < STATION_SLOTS && st == NULL; i++) {
+      station_t *slot = &stations[(h+i)%STATION_SLOTS];
+      if (!slot->used) {
+        st = slot;
+        st->used = true;
+        memcpy(st->key, key, station_key_len);
+        st->rssi = pkt->rssi;
+        st->snr_raw = pkt->snr_raw;
+      } else if (memcmp(slot->key, key, station_key_len) == 0) {
+        st = slot;
+      } else if (oldest == NULL || (int32_t)(slot->last_seen-oldest->last_seen) < 0) {
+        oldest = slot;
+      }
+    }
+
+    if (st == NULL) {
+      st = oldest;
+      memset(st, 0, sizeof(station_t));
+      st->used = true;
+      memcpy(st->key, key, station_key_len);
+      st->rssi = pkt->rssi;
+      st->snr_raw = pkt->snr_raw;
+    }
+
+    st->packets++;
+    st->airtime_us += (uint32_t)(((uint64_t)pkt->len*lora_byte_time_ns)/1000)+lora_overhead_us;
+    st->rssi = (st->rssi*3+pkt->rssi)/4;
+    st->snr_raw = (uint8_t)(((int8_t)st->snr_raw*3+(int8_t)pkt->snr_raw)/4);
+    st->last_seen = millis();
+  }
+#endif
+
 void ISR_VECT receive_callback(int packet_size) {
+  rx_packet_t *pkt = &rx_pool[rx_pool_head];
+  pkt->rx_us = LoRa->rxTimestamp();
   if (!promisc) {
     // The standard operating mode allows large
     // packets with a payload up to 500 bytes,
@@ -238,50 +440,103 @@ void ISR_VECT receive_callback(int packet_size) {
     uint8_t sequence = packetSequence(header);
     bool    ready    = false;
 
-    if (isSplitPacket(header) && seq == SEQ_UNSET) {
+    #if MCU_VARIANT == MCU_ESP32 || MCU_VARIANT == MCU_NRF52
+      if (header & FLAG_BEACON) {
+        // Channel change beacons are handled
+        // here, and not passed on to the host
+        autochan_beacon_rx(packet_size);
+        return;
+      }
+
+      if (header & FLAG_HOP) {
+        // Hopping frames carry the sender's slot
+        // position, which receivers align to
+        if (packet_size < HOP_HEADER_L) return;
+        uint8_t position = LoRa->read();
+        uint16_t elapsed_ms = (uint16_t)LoRa->read() << 8;
+        elapsed_ms |= LoRa->read();
+        packet_size -= HOP_HEADER_L;
+        if (hop_count != 0 && position < hop_count) hop_sync(position, elapsed_ms, HEADER_L+HOP_HEADER_L+packet_size);
+      }
+    #endif
+
+    if (isSplitPacket(header) && split_indexed(header & FLAG_HOP)) {
+      // Frames that can span more than two parts
+      // carry a fragment index, and a gap in the
+      // sequence drops the partial packet
+      if (packet_size < SPLIT_INDEX_L) return;
+      uint8_t index = LoRa->read(); packet_size--;
+      if (index == 0) {
+        pkt->len = 0;
+        seq = sequence;
+        seq_next = 1;
+        pkt->frags = 1;
+
+        pkt->rssi = LoRa->packetRssi();
+        pkt->snr_raw = LoRa->packetSnrRaw();
+
+        getPacketData(pkt, packet_size);
+
+      } else if (seq == sequence && index == seq_next) {
+        seq_next++;
+        pkt->frags++;
+
+        pkt->rssi = (pkt->rssi+LoRa->packetRssi())/2;
+        pkt->snr_raw = (pkt->snr_raw+LoRa->packetSnrRaw())/2;
+
+        getPacketData(pkt, packet_size);
+
+        if (!(header & FLAG_SPLIT_MORE)) {
+          seq = SEQ_UNSET;
+          ready = true;
+        }
+
+      } else {
+        seq = SEQ_UNSET;
+      }
+
+    } else if (isSplitPacket(header) && seq == SEQ_UNSET) {
       // This is the first part of a split
       // packet, so we set the seq variable
       // and add the data to the buffer
-      read_len = 0;
+      pkt->len = 0;
       seq = sequence;
+      pkt->frags = 1;
 
-      #if MCU_VARIANT != MCU_ESP32 && MCU_VARIANT != MCU_NRF52
-        last_rssi = LoRa->packetRssi();
-        last_snr_raw = LoRa->packetSnrRaw();
-      #endif
+      pkt->rssi = LoRa->packetRssi();
+      pkt->snr_raw = LoRa->packetSnrRaw();
 
-      getPacketData(packet_size);
+      getPacketData(pkt, packet_size);
 
     } else if (isSplitPacket(header) && seq == sequence) {
-      // This is the second part of a split
-      // packet, so we add it to the buffer
-      // and set the ready flag.
-      
+      // This is the next part of a split packet,
+      // so we add it to the buffer, and set the
+      // ready flag unless more parts will follow.
+      pkt->frags++;
 
-      #if MCU_VARIANT != MCU_ESP32 && MCU_VARIANT != MCU_NRF52
-        last_rssi = (last_rssi+LoRa->packetRssi())/2;
-        last_snr_raw = (last_snr_raw+LoRa->packetSnrRaw())/2;
-      #endif
+      pkt->rssi = (pkt->rssi+LoRa->packetRssi())/2;
+      pkt->snr_raw = (pkt->snr_raw+LoRa->packetSnrRaw())/2;
 
-      getPacketData(packet_size);
+      getPacketData(pkt, packet_size);
 
-      seq = SEQ_UNSET;
-      ready = true;
+      if (!(header & FLAG_SPLIT_MORE)) {
+        seq = SEQ_UNSET;
+        ready = true;
+      }
 
     } else if (isSplitPacket(header) && seq != sequence) {
       // This split packet does not carry the
       // same sequence id, so we must assume
       // that we are seeing the first part of
       // a new split packet.
-      read_len = 0;
+      pkt->len = 0;
       seq = sequence;
+      pkt->frags = 1;
 
-      #if MCU_VARIANT != MCU_ESP32 && MCU_VARIANT != MCU_NRF52
-        last_rssi = LoRa->packetRssi();
-        last_snr_raw = LoRa->packetSnrRaw();
-      #endif
+      pkt->rssi = LoRa->packetRssi();
+      pkt->snr_raw = LoRa->packetSnrRaw();
 
-      getPacketData(packet_size);
+      getPacketData(pkt, packet_size);
 
     } else if (!isSplitPacket(header)) {
       // This is not a split packet, so we
@@ -291,56 +546,86 @@ void ISR_VECT receive_callback(int packet_size) {
       if (seq != SEQ_UNSET) {
         // If we already had part of a split
         // packet in the buffer, we clear it.
-        read_len = 0;
         seq = SEQ_UNSET;
       }
+      pkt->len = 0;
+      pkt->frags = 1;
 
-      #if MCU_VARIANT != MCU_ESP32 && MCU_VARIANT != MCU_NRF52
-        last_rssi = LoRa->packetRssi();
-        last_snr_raw = LoRa->packetSnrRaw();
-      #endif
+      pkt->rssi = LoRa->packetRssi();
+      pkt->snr_raw = LoRa->packetSnrRaw();
 
-      getPacketData(packet_size);
+      getPacketData(pkt, packet_size);
       ready = true;
     }
 
-    if (ready) {
-      #if MCU_VARIANT != MCU_ESP32 && MCU_VARIANT != MCU_NRF52
-        // We first signal the RSSI of the
-        // recieved packet to the host.
-        kiss_indicate_stat_rssi();
-        kiss_indicate_stat_snr();
+    #if MCU_VARIANT == MCU_ESP32 || MCU_VARIANT == MCU_NRF52
+      // Packets not matching the receive filter
+      // are dropped before reaching the host
+      if (ready && !rx_filter_match(pkt)) ready = false;
+    #endif
 
-        // And then write the entire packet
-        kiss_write_packet();
-      #else
-        packet_ready = true;
-      #endif
+    if (ready) {
+      if (rx_meta) pkt->freq_error = LoRa->packetFrequencyError();
+      rx_pool_push();
     }  
   } else {
     // In promiscuous mode, raw packets are
     // output directly to the host
-    read_len = 0;
+    pkt->len = 0;
+    pkt->frags = 1;
 
-    #if MCU_VARIANT != MCU_ESP32 && MCU_VARIANT != MCU_NRF52
-      last_rssi = LoRa->packetRssi();
-      last_snr_raw = LoRa->packetSnrRaw();
-      getPacketData(packet_size);
+    pkt->rssi = LoRa->packetRssi();
+    pkt->snr_raw = LoRa->packetSnrRaw();
+    if (rx_meta) pkt->freq_error = LoRa->packetFrequencyError();
+    getPacketData(pkt, packet_size);
+    #if MCU_VARIANT == MCU_ESP32 || MCU_VARIANT == MCU_NRF52
+      station_record(pkt);
+    #endif
+    rx_pool_push();
+  }
+}
 
-      // We first signal the RSSI of the
-      // recieved packet to the host.
-      kiss_indicate_stat_rssi();
-      kiss_indicate_stat_snr();
+#if MCU_VARIANT == MCU_ESP32 || MCU_VARIANT == MCU_NRF52
+  void ISR_VECT radio_irq() {
+    BaseType_t woken = pdFALSE;
+    vTaskNotifyGiveFromISR(radio_task_handle, &woken);
+    #if MCU_VARIANT == MCU_ESP32
+      if (woken) portYIELD_FROM_ISR();
+    #else
+      portYIELD_FROM_ISR(woken);
+    #endif
+  }
 
-      // And then write the entire packet
-      kiss_write_packet();
+  void radio_task(void *param) {
+    while (true) {
+      ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+      modem_lock_take();
+      if (radio_online) LoRa->handleIrq();
+      modem_lock_give();
+    }
+  }
 
+  void sched_task(void *param) {
+    while (true) {
+      ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+      transmit_scheduled();
+    }
+  }
+
+  void radio_task_start() {
+    // Scheduled transmissions run just below the
+    // radio task, so they preempt the main loop
+    // and host I/O when the target time is near
+    modem_lock = xSemaphoreCreateRecursiveMutex();
+    #if MCU_VARIANT == MCU_ESP32
+      xTaskCreatePinnedToCore(radio_task, "radio", 4096, NULL, RADIO_TASK_PRIORITY, &radio_task_handle, 1);
+      xTaskCreatePinnedToCore(sched_task, "sched", 4096, NULL, RADIO_TASK_PRIORITY-1, &sched_task_handle, 1);
     #else
-      getPacketData(packet_size);
-      packet_ready = true;
+      xTaskCreate(radio_task, "radio", 1024, NULL, RADIO_TASK_PRIORITY, &radio_task_handle);
+      xTaskCreate(sched_task, "sched", 1024, NULL, RADIO_TASK_PRIORITY-1, &sched_task_handle);
     #endif
   }
-}
+#endif
 
 bool startRadio() {
   update_radio_lock();
@@ -359,14 +644,14 @@ bool startRadio() {
 
         init_channel_stats();
 
-        setTXPower();
-        setBandwidth();
-        setSpreadingFactor();
-        setCodingRate();
-        getFrequency();
+        applyRadioConfig();
 
         LoRa->enableCrc();
+        setSyncWord();
 
+        #if MCU_VARIANT == MCU_ESP32 || MCU_VARIANT == MCU_NRF52
+          LoRa->onIrq(radio_irq);
+        #endif
         LoRa->onReceive(receive_callback);
 
         lora_receive();
@@ -413,6 +698,72 @@ bool queueFull() {
 }
 
 volatile bool queue_flushing = false;
+void queue_release(uint16_t length) {
+  // Packets are accounted for one at a time,
+  // since the host may be queueing new ones
+  // while the queue is being flushed
+  #if MCU_VARIANT == MCU_ESP32
+    portENTER_CRITICAL(&mac_lock);
+  #endif
+  if (queue_height > 0) queue_height--;
+  if (queued_bytes > length) { queued_bytes -= length; } else { queued_bytes = 0; }
+  #if MCU_VARIANT == MCU_ESP32
+    portEXIT_CRITICAL(&mac_lock);
+  #endif
+}
+
+void mac_events_emit(uint8_t events) {
+  if (events & MAC_EVT_TXTS) kiss_indicate_stat_txts();
+  if (events & MAC_EVT_TXFAILED) kiss_indicate_error(ERROR_TXFAILED);
+  if (events & MAC_EVT_SCHED_MISSED) kiss_indicate_error(ERROR_SCHED_MISSED);
+  if (events & MAC_EVT_SPECTRUM) kiss_indicate_spectrum();
+  if (events & MAC_EVT_CHAN) kiss_indicate_stat_chan();
+  if (events & MAC_EVT_FREQ) kiss_indicate_frequency();
+  if (events & MAC_EVT_CHTM) kiss_indicate_channel_stats();
+  if (events & MAC_EVT_HOP) {
+    modem_lock_take();
+    kiss_indicate_hop();
+    modem_lock_give();
+  }
+}
+
+void mac_indicate(uint8_t event) {
+  #if MCU_VARIANT == MCU_ESP32
+    // Only the host task writes to the host,
+    // so the event is passed over to it
+    portENTER_CRITICAL(&mac_lock);
+    mac_events |= event;
+    portEXIT_CRITICAL(&mac_lock);
+  #elif MCU_VARIANT == MCU_NRF52
+    // The scheduler task also raises events, so
+    // they are written out from the main loop
+    taskENTER_CRITICAL();
+    mac_events |= event;
+    taskEXIT_CRITICAL();
+  #else
+    mac_events_emit(event);
+  #endif
+}
+
+void mac_events_flush() {
+  #if MCU_VARIANT == MCU_ESP32 || MCU_VARIANT == MCU_NRF52
+    if (mac_events == 0x00) return;
+    #if MCU_VARIANT == MCU_ESP32
+      portENTER_CRITICAL(&mac_lock);
+    #else
+      taskENTER_CRITICAL();
+    #endif
+    uint8_t events = mac_events;
+    mac_events = 0x00;
+    #if MCU_VARIANT == MCU_ESP32
+      portEXIT_CRITICAL(&mac_lock);
+    #else
+      taskEXIT_CRITICAL();
+    #endif
+    mac_events_emit(events);
+  #endif
+}
+
 void flushQueue(void) {
   if (!queue_flushing) {
     queue_flushing = true;
@@ -428,6 +779,7 @@ void flushQueue(void) {
 
       uint16_t start = fifo16_pop(&packet_starts);
       uint16_t length = fifo16_pop(&packet_lengths);
+      queue_release(length);
 
       if (length >= MIN_L && length <= MTU) {
         for (uint16_t i = 0; i < length; i++) {
@@ -443,31 +795,139 @@ void flushQueue(void) {
     lora_receive();
     led_tx_off();
     post_tx_yield_timeout = millis()+(lora_post_tx_yield_slots*csma_slot_ms);
+    csma_state = CSMA_IDLE;
+    csma_be = csma_be_min;
   }
 
-  queue_height = 0;
-  queued_bytes = 0;
+  #if MCU_VARIANT != MCU_ESP32
+    // Without a concurrent host writer, the
+    // counters can be reset outright
+    queue_height = 0;
+    queued_bytes = 0;
+  #endif
   #if MCU_VARIANT == MCU_ESP32 || MCU_VARIANT == MCU_NRF52
     update_airtime();
   #endif
   queue_flushing = false;
 }
 
-#define PHY_HEADER_LORA_SYMBOLS 8
 void add_airtime(uint16_t written) {
   #if MCU_VARIANT == MCU_ESP32 || MCU_VARIANT == MCU_NRF52
-    float packet_cost_ms = 0.0;
-    float payload_cost_ms = ((float)written * lora_us_per_byte)/1000.0;
-    packet_cost_ms += payload_cost_ms;
-    packet_cost_ms += (lora_preamble_symbols+4.25)*lora_symbol_time_ms;
-    packet_cost_ms += PHY_HEADER_LORA_SYMBOLS * lora_symbol_time_ms;
+    uint32_t packet_cost_us = (uint32_t)(((uint64_t)written*lora_byte_time_ns)/1000);
+    packet_cost_us += lora_overhead_us;
+    uint16_t packet_cost_ms = packet_cost_us/1000;
     uint16_t cb = current_airtime_bin();
     uint16_t nb = cb+1; if (nb == AIRTIME_BINS) { nb = 0; }
     airtime_bins[cb] += packet_cost_ms;
     airtime_bins[nb] = 0;
+    if (hop_count != 0) hop_airtime_ms[hop_index] += packet_cost_ms;
   #endif
 }
 
+#if MCU_VARIANT == MCU_ESP32 || MCU_VARIANT == MCU_NRF52
+  bool sched_blocks_flush() {
+    // Hold back queued traffic if flushing it
+    // could still be on air at the scheduled
+    // transmission time
+    if (!sched_pending) return false;
+    uint32_t flush_us = (uint32_t)(((uint64_t)queued_bytes*lora_byte_time_ns)/1000);
+    flush_us += (uint32_t)queue_height*lora_overhead_us;
+    int32_t remaining = (int32_t)(sched_at-micros());
+    return remaining < (int32_t)flush_us+SCHED_LEAD_US;
+  }
+
+  void transmit_scheduled() {
+    // Sleep until shortly before the target time,
+    // re-reading the schedule on every wakeup so
+    // a cancelled or replaced frame is noticed
+    while (sched_pending) {
+      int32_t remaining = (int32_t)(sched_at-micros());
+      if (remaining <= SCHED_PRELOAD_US+SCHED_TICK_US) break;
+      vTaskDelay((remaining-SCHED_PRELOAD_US)/SCHED_TICK_US);
+    }
+
+    // The frame stays pending, so the buffer
+    // can't be refilled, until it has been sent
+    modem_lock_take();
+    if (!sched_pending) { modem_lock_give(); return; }
+    if ((int32_t)(sched_at-micros()) < -SCHED_LATE_US || airtime_lock || !radio_online || scan_active) {
+      sched_pending = false;
+      modem_lock_give();
+      mac_indicate(MAC_EVT_SCHED_MISSED);
+      return;
+    }
+
+    // Load the frame into the modem ahead of
+    // time, so only the TX opcode is left to
+    // issue once the target time is reached
+    led_tx_on();
+    uint16_t written = 0;
+    if (!promisc) {
+      if (hop_count != 0) hop_tx_prepare();
+      LoRa->beginPacket();
+      written += write_header(random(256) & 0xF0);
+    } else {
+      if (!implicit) {
+        LoRa->beginPacket();
+      } else {
+        LoRa->beginPacket(sched_len);
+      }
+    }
+
+    for (uint16_t i = 0; i < sched_len; i++) {
+      LoRa->write(sched_buf[i]);
+      written++;
+    }
+
+    // Sleep in whole ticks, and only busy-wait
+    // for the last stretch before the target
+    while ((int32_t)(sched_at-micros()) > SCHED_SPIN_US+SCHED_TICK_US) vTaskDelay(1);
+    while ((int32_t)(sched_at-micros()) > 0) { }
+    LoRa->endPacket(); add_airtime(written);
+    sched_pending = false;
+
+    last_tx_us = LoRa->txTimestamp();
+    lora_receive();
+    modem_lock_give();
+
+    if (rx_meta) mac_indicate(MAC_EVT_TXTS);
+    led_tx_off();
+    update_airtime();
+  }
+
+  void rx_sniff() {
+    // Firmware fallback for modems without a
+    // hardware RX duty cycle. The modem sleeps,
+    // and is woken periodically to run CAD.
+    uint32_t now = millis();
+    if (sniff_rx_until != 0) {
+      if ((int32_t)(now-sniff_rx_until) < 0) return;
+      sniff_rx_until = 0;
+      modem_lock_take();
+      LoRa->sleep();
+      modem_lock_give();
+    }
+
+    if ((int32_t)(now-sniff_next) >= 0) {
+      modem_lock_take();
+      sniff_next = now+rx_duty_sleep_ms;
+      if (LoRa->channelActivityDetect(LORA_CAD_SYMBOLS)) {
+        // Stay in receive for the rest of the
+        // preamble and a full length packet
+        uint32_t window_ms = rx_duty_rx_ms;
+        window_ms += (uint32_t)(((uint64_t)lora_preamble_symbols*lora_symbol_time_ns)/1000000);
+        window_ms += (uint32_t)(((uint64_t)MTU*lora_byte_time_ns)/1000000);
+        lora_receive();
+        sniff_rx_until = now+window_ms;
+        if (sniff_rx_until == 0) sniff_rx_until = 1;
+      } else {
+        LoRa->sleep();
+      }
+      modem_lock_give();
+    }
+  }
+#endif
+
 void update_airtime() {
   #if MCU_VARIANT == MCU_ESP32 || MCU_VARIANT == MCU_NRF52
     uint16_t cb = current_airtime_bin();
@@ -491,33 +951,71 @@ void update_airtime() {
     #if MCU_VARIANT == MCU_ESP32 || MCU_VARIANT == MCU_NRF52
       update_csma_p();
     #endif
-    kiss_indicate_channel_stats();
+    mac_indicate(MAC_EVT_CHTM);
+  #endif
+}
+
+uint8_t header_length() {
+  #if MCU_VARIANT == MCU_ESP32 || MCU_VARIANT == MCU_NRF52
+    if (hop_count != 0) return HEADER_L+HOP_HEADER_L;
+  #endif
+  return HEADER_L;
+}
+
+bool split_indexed(bool hopping) {
+  // Plain LoRa frames are split in at most two
+  // parts, and keep the unindexed split format
+  return hopping || lora_frame_mtu < SINGLE_MTU;
+}
+
+uint8_t write_header(uint8_t header) {
+  #if MCU_VARIANT == MCU_ESP32 || MCU_VARIANT == MCU_NRF52
+    if (hop_count != 0) {
+      LoRa->write(header | FLAG_HOP);
+      hop_write_header();
+      return HEADER_L+HOP_HEADER_L;
+    }
   #endif
+  LoRa->write(header);
+  return HEADER_L;
 }
 
 void transmit(uint16_t size) {
   if (radio_online) {
+    modem_lock_take();
     if (!promisc) {
       uint16_t  written = 0;
       uint8_t header  = random(256) & 0xF0;
+      uint8_t header_l = header_length();
+      uint16_t frame_l = lora_frame_mtu - header_l;
+      bool indexed = false;
+      uint8_t index = 0;
 
-      if (size > SINGLE_MTU - HEADER_L) {
+      if (size > frame_l) {
         header = header | FLAG_SPLIT;
+        if (split_indexed(header_l > HEADER_L)) {
+          indexed = true;
+          frame_l -= SPLIT_INDEX_L;
+        }
       }
 
+      // Modulations with short frames can need
+      // more than two parts, so every part but
+      // the last is flagged as having followers
       LoRa->beginPacket();
-      LoRa->write(header); written++;
+      written += write_header(size > frame_l ? header | FLAG_SPLIT_MORE : header);
+      if (indexed) { LoRa->write(index++); written++; }
 
       for (uint16_t i=0; i < size; i++) {
         LoRa->write(tbuf[i]);
 
         written++;
 
-        if (written == 255) {
+        if (written == lora_frame_mtu && i+1 < size) {
           LoRa->endPacket(); add_airtime(written);
           LoRa->beginPacket();
-          LoRa->write(header);
-          written = 1;
+          written = write_header(size-i-1 > frame_l ? header | FLAG_SPLIT_MORE : header);
+          if (indexed) { LoRa->write(index++); written++; }
         }
       }
 
@@ -529,9 +1027,10 @@ void transmit(uint16_t size) {
       led_tx_on();
       uint16_t  written = 0;
       
-      // Cap packets at 255 bytes
-      if (size > SINGLE_MTU) {
-        size = SINGLE_MTU;
+      // Cap packets at the frame size of the
+      // current modulation, 255 bytes for LoRa
+      if (size > lora_frame_mtu) {
+        size = lora_frame_mtu;
       }
 
       // If implicit header mode has been set,
@@ -549,14 +1048,156 @@ void transmit(uint16_t size) {
       }
       LoRa->endPacket(); add_airtime(written);
     }
+
+    last_tx_us = LoRa->txTimestamp();
+    modem_lock_give();
+    if (rx_meta) mac_indicate(MAC_EVT_TXTS);
   } else {
-    kiss_indicate_error(ERROR_TXFAILED);
+    mac_indicate(MAC_EVT_TXFAILED);
     led_indicate_error(5);
   }
 }
 
 void serialCallback(uint8_t sbyte) {
-  if (IN_FRAME && sbyte == FEND && command == CMD_DATA) {
+  if (IN_FRAME && sbyte == FEND && command == CMD_DATA_AT) {
+    IN_FRAME = false;
+
+    #if MCU_VARIANT == MCU_ESP32 || MCU_VARIANT == MCU_NRF52
+      uint16_t max_l = promisc ? lora_frame_mtu : lora_frame_mtu-header_length();
+      if (frame_len == 4) {
+        // A frame without payload cancels any
+        // pending scheduled transmission
+        sched_pending = false;
+      } else if (sched_pending || sched_dropped) {
+        // Bytes arriving while another frame was
+        // pending were dropped, so the whole frame
+        // is rejected. Oversized frames are only
+        // counted, and fail the length check below.
+        kiss_indicate_error(ERROR_QUEUE_FULL);
+      } else if (frame_len > 4 && frame_len-4 <= max_l) {
+        sched_at = (uint32_t)cmdbuf[0] << 24 | (uint32_t)cmdbuf[1] << 16 | (uint32_t)cmdbuf[2] << 8 | (uint32_t)cmdbuf[3];
+        sched_len = frame_len-4;
+        sched_pending = true;
+        xTaskNotifyGive(sched_task_handle);
+      } else {
+        kiss_indicate_error(ERROR_TXFAILED);
+      }
+    #else
+      kiss_indicate_error(ERROR_TXFAILED);
+    #endif
+
+  } else if (IN_FRAME && sbyte == FEND && command == CMD_AUTOCHAN) {
+    IN_FRAME = false;
+
+    // Mode, interval in minutes and up to
+    // AUTOCHAN_MAX allowed frequencies. An
+    // empty frame only queries the settings.
+    #if MCU_VARIANT == MCU_ESP32 || MCU_VARIANT == MCU_NRF52
+      if (frame_len >= 2 && (frame_len-2)%4 == 0 && (frame_len-2)/4 <= AUTOCHAN_MAX && cmdbuf[0] <= AUTOCHAN_MOVE) {
+        autochan_mode = cmdbuf[0];
+        autochan_interval_min = cmdbuf[1];
+        autochan_count = (frame_len-2)/4;
+        for (uint8_t i = 0; i < autochan_count; i++) {
+          uint8_t *f = &cmdbuf[2+i*4];
+          autochan_freqs[i] = (uint32_t)f[0] << 24 | (uint32_t)f[1] << 16 | (uint32_t)f[2] << 8 | (uint32_t)f[3];
+          autochan_util[i] = 0.0;
+          autochan_score[i] = 0xFF;
+        }
+        autochan_best = 0;
+        autochan_next = millis();
+      }
+    #endif
+    kiss_indicate_autochan();
+
+  } else if (IN_FRAME && sbyte == FEND && command == CMD_RX_FILTER) {
+    IN_FRAME = false;
+
+    // Header byte offset, prefix length and up
+    // to RX_FILTER_SLOTS prefixes. No prefixes
+    // disables the filter, and an empty frame
+    // only queries it.
+    #if MCU_VARIANT == MCU_ESP32 || MCU_VARIANT == MCU_NRF52
+      if (frame_len >= 2 && cmdbuf[1] != 0 && cmdbuf[1] <= RX_FILTER_KEY_MAX && (frame_len-2)%cmdbuf[1] == 0 && (frame_len-2)/cmdbuf[1] <= RX_FILTER_SLOTS) {
+        rx_filter_offset = cmdbuf[0];
+        rx_filter_len = cmdbuf[1];
+        rx_filter_count = (frame_len-2)/rx_filter_len;
+        for (uint8_t i = 0; i < rx_filter_count; i++) {
+          memcpy(rx_filter[i], &cmdbuf[2+i*rx_filter_len], rx_filter_len);
+        }
+        rx_filtered = 0;
+      }
+    #endif
+    kiss_indicate_rx_filter();
+
+  } else if (IN_FRAME && sbyte == FEND && command == CMD_PROFILE) {
+    IN_FRAME = false;
+
+    // A single index byte switches to a stored
+    // profile, and only the active index is sent
+    // back. An index followed by frequency,
+    // bandwidth, SF, CR, TX power and sync word
+    // stores a profile. An empty frame queries.
+    #if MCU_VARIANT == MCU_ESP32 || MCU_VARIANT == MCU_NRF52
+      if (frame_len == 1) {
+        profile_select(cmdbuf[0]);
+        kiss_indicate_profile(false);
+      } else {
+        if (frame_len == 13 && cmdbuf[0] < PROFILE_SLOTS) {
+          // Parameters are checked as strictly as
+          // when they are set one at a time, and a
+          // frequency or bandwidth outside what the
+          // modem supports clears the slot
+          radio_profile_t *p = &profiles[cmdbuf[0]];
+          p->freq = (uint32_t)cmdbuf[1] << 24 | (uint32_t)cmdbuf[2] << 16 | (uint32_t)cmdbuf[3] << 8 | (uint32_t)cmdbuf[4];
+          p->bw = (uint32_t)cmdbuf[5] << 24 | (uint32_t)cmdbuf[6] << 16 | (uint32_t)cmdbuf[7] << 8 | (uint32_t)cmdbuf[8];
+          p->sf = clampSpreadingFactor(cmdbuf[9]);
+          p->cr = clampCodingRate(cmdbuf[10]);
+          p->txp = clampTXPower(cmdbuf[11]);
+          p->sync_word = cmdbuf[12];
+          p->used = (p->freq >= PROFILE_FREQ_MIN && p->freq <= PROFILE_FREQ_MAX && p->bw >= PROFILE_BW_MIN && p->bw <= PROFILE_BW_MAX);
+          if (profile_active == cmdbuf[0]) profile_active = PROFILE_NONE;
+        }
+        kiss_indicate_profile(true);
+      }
+    #else
+      kiss_indicate_profile(false);
+    #endif
+
+  } else if (IN_FRAME && sbyte == FEND && command == CMD_HOP) {
+    IN_FRAME = false;
+
+    // Dwell time and seed, followed by the
+    // frequencies to hop over. A frame with no
+    // frequencies stops hopping, and an empty
+    // frame only queries the current settings.
+    #if MCU_VARIANT == MCU_ESP32 || MCU_VARIANT == MCU_NRF52
+      if (frame_len >= 4 && (frame_len-4)%4 == 0 && (frame_len-4)/4 <= HOP_MAX) {
+        // The table is staged, and the new settings
+        // are sent back once the main loop has
+        // switched over to them
+        uint8_t count = (frame_len-4)/4;
+        for (uint8_t i = 0; i < count; i++) {
+          uint8_t *f = &cmdbuf[4+i*4];
+          hop_next_freqs[i] = (uint32_t)f[0] << 24 | (uint32_t)f[1] << 16 | (uint32_t)f[2] << 8 | (uint32_t)f[3];
+        }
+        hop_next_dwell_ms = (uint16_t)cmdbuf[0] << 8 | cmdbuf[1];
+        hop_next_seed = (uint16_t)cmdbuf[2] << 8 | cmdbuf[3];
+        hop_next_count = count;
+        hop_reload = true;
+      } else {
+        kiss_indicate_hop();
+      }
+    #else
+      kiss_indicate_hop();
+    #endif
+
+  } else if (IN_FRAME && sbyte == FEND && (command & NIBBLE_CMD) == CMD_DATA && (command >> 4) < KISS_PORTS_MAX && command != CMD_DATA) {
+    // Data for a KISS port this device does not
+    // serve is dropped and reported to the host
+    IN_FRAME = false;
+    kiss_indicate_error(ERROR_PORT);
+
+  } else if (IN_FRAME && sbyte == FEND && command == CMD_DATA) {
     IN_FRAME = false;
 
     if (!fifo16_isfull(&packet_starts) && queued_bytes < CONFIG_QUEUE_SIZE) {
@@ -571,10 +1212,19 @@ void serialCallback(uint8_t sbyte) {
         }
 
         if (l >= MIN_L) {
-            queue_height++;
-
-            fifo16_push(&packet_starts, s);
+            // The length is pushed before the start,
+            // so a start seen by the flushing side
+            // always has its length available
             fifo16_push(&packet_lengths, l);
+            fifo16_push(&packet_starts, s);
+
+            #if MCU_VARIANT == MCU_ESP32
+              portENTER_CRITICAL(&mac_lock);
+            #endif
+            queue_height++;
+            #if MCU_VARIANT == MCU_ESP32
+              portEXIT_CRITICAL(&mac_lock);
+            #endif
 
             current_packet_start = queue_cursor;
         }
@@ -589,6 +1239,7 @@ void serialCallback(uint8_t sbyte) {
     // Have a look at the command byte first
     if (frame_len == 0 && command == CMD_UNKNOWN) {
         command = sbyte;
+        if ((sbyte & NIBBLE_CMD) == CMD_DATA && (sbyte >> 4) < KISS_PORTS) command = CMD_DATA;
     } else if (command == CMD_DATA) {
         if (bt_state != BT_STATE_CONNECTED) cable_state = CABLE_STATE_CONNECTED;
         if (sbyte == FESC) {
@@ -600,11 +1251,49 @@ void serialCallback(uint8_t sbyte) {
                 ESCAPE = false;
             }
             if (queue_height < CONFIG_QUEUE_MAX_LENGTH && queued_bytes < CONFIG_QUEUE_SIZE) {
+              #if MCU_VARIANT == MCU_ESP32
+                portENTER_CRITICAL(&mac_lock);
+              #endif
               queued_bytes++;
+              #if MCU_VARIANT == MCU_ESP32
+                portEXIT_CRITICAL(&mac_lock);
+              #endif
               packet_queue[queue_cursor++] = sbyte;
               if (queue_cursor == CONFIG_QUEUE_SIZE) queue_cursor = 0;
             }
         }
+    } else if (command == CMD_AUTOCHAN || command == CMD_RX_FILTER || command == CMD_PROFILE || command == CMD_HOP) {
+      if (sbyte == FESC) {
+            ESCAPE = true;
+        } else {
+            if (ESCAPE) {
+                if (sbyte == TFEND) sbyte = FEND;
+                if (sbyte == TFESC) sbyte = FESC;
+                ESCAPE = false;
+            }
+            if (frame_len < CMD_L) cmdbuf[frame_len++] = sbyte;
+        }
+    } else if (command == CMD_DATA_AT) {
+      #if MCU_VARIANT == MCU_ESP32 || MCU_VARIANT == MCU_NRF52
+        if (sbyte == FESC) {
+            ESCAPE = true;
+        } else {
+            if (ESCAPE) {
+                if (sbyte == TFEND) sbyte = FEND;
+                if (sbyte == TFESC) sbyte = FESC;
+                ESCAPE = false;
+            }
+            if (frame_len < 4) {
+              if (frame_len == 0) sched_dropped = false;
+              cmdbuf[frame_len] = sbyte;
+            } else if (sched_pending) {
+              sched_dropped = true;
+            } else if (frame_len-4 < SINGLE_MTU) {
+              sched_buf[frame_len-4] = sbyte;
+            }
+            frame_len++;
+        }
+      #endif
     } else if (command == CMD_FREQUENCY) {
       if (sbyte == FESC) {
             ESCAPE = true;
@@ -655,14 +1344,7 @@ void serialCallback(uint8_t sbyte) {
       if (sbyte == 0xFF) {
         kiss_indicate_txpower();
       } else {
-        int txp = sbyte;
-        #if MODEM == SX1262
-          if (txp > 22) txp = 22;
-        #else
-          if (txp > 17) txp = 17;
-        #endif
-
-        lora_txp = txp;
+        lora_txp = clampTXPower(sbyte);
         if (op_mode == MODE_HOST) setTXPower();
         kiss_indicate_txpower();
       }
@@ -670,11 +1352,7 @@ void serialCallback(uint8_t sbyte) {
       if (sbyte == 0xFF) {
         kiss_indicate_spreadingfactor();
       } else {
-        int sf = sbyte;
-        if (sf < 5) sf = 5;
-        if (sf > 12) sf = 12;
-
-        lora_sf = sf;
+        lora_sf = clampSpreadingFactor(sbyte);
         if (op_mode == MODE_HOST) setSpreadingFactor();
         kiss_indicate_spreadingfactor();
       }
@@ -682,11 +1360,7 @@ void serialCallback(uint8_t sbyte) {
       if (sbyte == 0xFF) {
         kiss_indicate_codingrate();
       } else {
-        int cr = sbyte;
-        if (cr < 5) cr = 5;
-        if (cr > 8) cr = 8;
-
-        lora_cr = cr;
+        lora_cr = clampCodingRate(sbyte);
         if (op_mode == MODE_HOST) setCodingRate();
         kiss_indicate_codingrate();
       }
@@ -700,6 +1374,7 @@ void serialCallback(uint8_t sbyte) {
         last_rssi     = -292;
         last_rssi_raw = 0x00;
         last_snr_raw  = 0x80;
+        rx_meta       = false;
       }
     } else if (command == CMD_RADIO_STATE) {
       if (bt_state != BT_STATE_CONNECTED) cable_state = CABLE_STATE_CONNECTED;
@@ -764,6 +1439,12 @@ void serialCallback(uint8_t sbyte) {
       kiss_indicate_stat_tx();
     } else if (command == CMD_STAT_RSSI) {
       kiss_indicate_stat_rssi();
+    } else if (command == CMD_STAT_RXPOOL) {
+      kiss_indicate_stat_rxpool();
+    } else if (command == CMD_STAT_STATIONS) {
+      kiss_indicate_stat_stations();
+    } else if (command == CMD_STAT_TIME) {
+      kiss_indicate_stat_time();
     } else if (command == CMD_RADIO_LOCK) {
       update_radio_lock();
       kiss_indicate_radio_lock();
@@ -783,6 +1464,219 @@ void serialCallback(uint8_t sbyte) {
         promisc_disable();
       }
       kiss_indicate_promisc();
+    } else if (command == CMD_RX_META) {
+      if (sbyte == 0x01) {
+        rx_meta = true;
+      } else if (sbyte == 0x00) {
+        rx_meta = false;
+      }
+      kiss_indicate_rx_meta();
+    } else if (command == CMD_MODULATION) {
+      // 0xFF only queries the modulation
+      if (sbyte <= MODULATION_FLRC) {
+        lora_modulation = sbyte;
+        setModulation();
+        if (radio_online) lora_receive();
+      }
+      kiss_indicate_modulation();
+    } else if (command == CMD_SYNC_WORD) {
+      if (sbyte == FESC) {
+            ESCAPE = true;
+        } else {
+            if (ESCAPE) {
+                if (sbyte == TFEND) sbyte = FEND;
+                if (sbyte == TFESC) sbyte = FESC;
+                ESCAPE = false;
+            }
+            // Only radios with the same sync word
+            // receive each other, 0xFF only queries.
+            // The setting is only stored along with
+            // the rest of the TNC configuration.
+            if (sbyte != 0xFF) {
+              lora_sync_word = sbyte;
+              setSyncWord();
+            }
+            kiss_indicate_sync_word();
+        }
+    } else if (command == CMD_LBT) {
+      if (sbyte == 0x01) {
+        cad_lbt = true;
+      } else if (sbyte == 0x00) {
+        cad_lbt = false;
+      }
+      kiss_indicate_lbt();
+    } else if (command == CMD_RX_DUTY) {
+      if (sbyte == FESC) {
+            ESCAPE = true;
+        } else {
+            if (ESCAPE) {
+                if (sbyte == TFEND) sbyte = FEND;
+                if (sbyte == TFESC) sbyte = FESC;
+                ESCAPE = false;
+            }
+            if (frame_len < CMD_L) cmdbuf[frame_len++] = sbyte;
+        }
+
+        if (frame_len == 4) {
+          #if MCU_VARIANT == MCU_ESP32 || MCU_VARIANT == MCU_NRF52
+            uint16_t rx_ms = (uint16_t)cmdbuf[0] << 8 | (uint16_t)cmdbuf[1];
+            uint16_t sleep_ms = (uint16_t)cmdbuf[2] << 8 | (uint16_t)cmdbuf[3];
+            if (rx_ms == 0 || sleep_ms == 0 || lora_modulation != MODULATION_LORA) {
+              rx_duty = false;
+              rx_duty_rx_ms = 0;
+              rx_duty_sleep_ms = 0;
+            } else {
+              rx_duty = true;
+              rx_duty_rx_ms = rx_ms;
+              rx_duty_sleep_ms = sleep_ms;
+            }
+            rx_duty_hw = false;
+            sniff_next = millis();
+            sniff_rx_until = 0;
+            updateBitrate();
+            if (radio_online) lora_receive();
+          #endif
+          kiss_indicate_rx_duty();
+        }
+    } else if (command == CMD_TX_WAKE) {
+      if (sbyte == FESC) {
+            ESCAPE = true;
+        } else {
+            if (ESCAPE) {
+                if (sbyte == TFEND) sbyte = FEND;
+                if (sbyte == TFESC) sbyte = FESC;
+                ESCAPE = false;
+            }
+            if (frame_len < CMD_L) cmdbuf[frame_len++] = sbyte;
+        }
+
+        if (frame_len == 2) {
+          // Sleep and listen period of the receivers
+          // to reach, independent of whether this
+          // node duty-cycles itself. Zero disables
+          // the long preamble for sending.
+          #if MCU_VARIANT == MCU_ESP32 || MCU_VARIANT == MCU_NRF52
+            tx_wake_ms = (uint16_t)cmdbuf[0] << 8 | (uint16_t)cmdbuf[1];
+            updateBitrate();
+          #endif
+          kiss_indicate_tx_wake();
+        }
+    } else if (command == CMD_CSMA_PARAMS) {
+      if (sbyte == FESC) {
+            ESCAPE = true;
+        } else {
+            if (ESCAPE) {
+                if (sbyte == TFEND) sbyte = FEND;
+                if (sbyte == TFESC) sbyte = FESC;
+                ESCAPE = false;
+            }
+            if (frame_len < CMD_L) cmdbuf[frame_len++] = sbyte;
+        }
+
+        if (frame_len == 4) {
+          // A slot time of 0xFFFF only queries the
+          // current parameters. A zero slot time
+          // derives the slot from the symbol time,
+          // and a zero maximum exponent turns the
+          // exponential backoff off.
+          uint16_t slot_ms = (uint16_t)cmdbuf[0] << 8 | (uint16_t)cmdbuf[1];
+          uint8_t be_min = cmdbuf[2];
+          uint8_t be_max = cmdbuf[3];
+          if (be_min <= be_max && be_max <= CSMA_BE_LIMIT && slot_ms <= CSMA_SLOT_MAX_MS) {
+            csma_slot_fixed_ms = slot_ms;
+            csma_be_min = be_min;
+            csma_be_max = be_max;
+            csma_be = be_min;
+            update_csma_slot();
+          }
+          kiss_indicate_csma_params();
+        }
+    } else if (command == CMD_CSMA_CURVE) {
+      if (sbyte == FESC) {
+            ESCAPE = true;
+        } else {
+            if (ESCAPE) {
+                if (sbyte == TFEND) sbyte = FEND;
+                if (sbyte == TFESC) sbyte = FESC;
+                ESCAPE = false;
+            }
+            if (frame_len < CMD_L) cmdbuf[frame_len++] = sbyte;
+        }
+
+        if (frame_len == 3) {
+          // A zero slope only queries the curve
+          #if MCU_VARIANT == MCU_ESP32 || MCU_VARIANT == MCU_NRF52
+            if (cmdbuf[0] != 0 && cmdbuf[1] <= cmdbuf[2]) {
+              csma_p_min = cmdbuf[1]/255.0;
+              csma_p_max = cmdbuf[2]/255.0;
+              csma_curve_build(cmdbuf[0]);
+              update_csma_p();
+            }
+          #endif
+          kiss_indicate_csma_curve();
+        }
+    } else if (command == CMD_STATIONS) {
+      if (sbyte == FESC) {
+            ESCAPE = true;
+        } else {
+            if (ESCAPE) {
+                if (sbyte == TFEND) sbyte = FEND;
+                if (sbyte == TFESC) sbyte = FESC;
+                ESCAPE = false;
+            }
+            if (frame_len < CMD_L) cmdbuf[frame_len++] = sbyte;
+        }
+
+        if (frame_len == 2) {
+          // Header byte offset and key length, a
+          // zero length disables station tracking
+          #if MCU_VARIANT == MCU_ESP32 || MCU_VARIANT == MCU_NRF52
+            if (cmdbuf[1] <= STATION_KEY_MAX) {
+              station_key_offset = cmdbuf[0];
+              station_key_len = cmdbuf[1];
+              stations_reset();
+            }
+          #endif
+          kiss_indicate_stations();
+        }
+    } else if (command == CMD_SCAN) {
+      if (sbyte == FESC) {
+            ESCAPE = true;
+        } else {
+            if (ESCAPE) {
+                if (sbyte == TFEND) sbyte = FEND;
+                if (sbyte == TFESC) sbyte = FESC;
+                ESCAPE = false;
+            }
+            if (frame_len < CMD_L) cmdbuf[frame_len++] = sbyte;
+        }
+
+        if (frame_len == 15) {
+          // Start frequency, step, channel count,
+          // dwell time in ms and bandwidth, where
+          // a zero bandwidth keeps the current one
+          #if MCU_VARIANT == MCU_ESP32 || MCU_VARIANT == MCU_NRF52
+            uint32_t start = (uint32_t)cmdbuf[0] << 24 | (uint32_t)cmdbuf[1] << 16 | (uint32_t)cmdbuf[2] << 8 | (uint32_t)cmdbuf[3];
+            uint32_t step = (uint32_t)cmdbuf[4] << 24 | (uint32_t)cmdbuf[5] << 16 | (uint32_t)cmdbuf[6] << 8 | (uint32_t)cmdbuf[7];
+            uint8_t count = cmdbuf[8];
+            uint16_t dwell = (uint16_t)cmdbuf[9] << 8 | (uint16_t)cmdbuf[10];
+            uint32_t bw = (uint32_t)cmdbuf[11] << 24 | (uint32_t)cmdbuf[12] << 16 | (uint32_t)cmdbuf[13] << 8 | (uint32_t)cmdbuf[14];
+            if (radio_online && !scan_active && !scan_requested && count > 0 && count <= SCAN_MAX_CHANNELS && dwell > 0) {
+              // The sweep itself is started from the
+              // main loop, which owns the MAC state
+              scan_start = start;
+              scan_step = step;
+              scan_count = count;
+              scan_dwell_ms = dwell;
+              scan_bw = bw;
+              scan_requested = true;
+            } else {
+              kiss_indicate_error(ERROR_SCAN);
+            }
+          #else
+            kiss_indicate_error(ERROR_SCAN);
+          #endif
+        }
     } else if (command == CMD_READY) {
       if (!queueFull()) {
         kiss_indicate_ready();
@@ -967,26 +1861,12 @@ void serialCallback(uint8_t sbyte) {
   }
 }
 
-#if MCU_VARIANT == MCU_ESP32
-  portMUX_TYPE update_lock = portMUX_INITIALIZER_UNLOCKED;
-#endif
-
 void updateModemStatus() {
-  #if MCU_VARIANT == MCU_ESP32
-    portENTER_CRITICAL(&update_lock);
-  #elif MCU_VARIANT == MCU_NRF52
-    portENTER_CRITICAL();
-  #endif
-
+  modem_lock_take();
   uint8_t status = LoRa->modemStatus();
   current_rssi = LoRa->currentRssi();
   last_status_update = millis();
-
-  #if MCU_VARIANT == MCU_ESP32
-    portEXIT_CRITICAL(&update_lock);
-  #elif MCU_VARIANT == MCU_NRF52
-    portEXIT_CRITICAL();
-  #endif
+  modem_lock_give();
 
   if ((status & SIG_DETECT) == SIG_DETECT) { stat_signal_detected = true; } else { stat_signal_detected = false; }
   if ((status & SIG_SYNCED) == SIG_SYNCED) { stat_signal_synced = true; } else { stat_signal_synced = false; }
@@ -1185,64 +2065,469 @@ void validate_status() {
 }
 
 #if MCU_VARIANT == MCU_ESP32 || MCU_VARIANT == MCU_NRF52
-  #define _e 2.71828183
-  #define _S 10.0
-  float csma_slope(float u) { return (pow(_e,_S*u-_S/2.0))/(pow(_e,_S*u-_S/2.0)+1.0); }
+  // Persistence values indexed by short-term
+  // airtime quantised to 8 bits. The default is
+  // the logistic curve with slope 10.0 between
+  // csma_p_min and csma_p_max, precomputed.
+  uint8_t csma_p_curve[256] = {
+    228, 228, 228, 228, 228, 228, 227, 227, 227, 227, 227, 227, 227, 227, 227, 227,
+    227, 227, 227, 227, 226, 226, 226, 226, 226, 226, 226, 226, 225, 225, 225, 225,
+    225, 225, 225, 224, 224, 224, 224, 224, 223, 223, 223, 223, 222, 222, 222, 222,
+    221, 221, 221, 221, 220, 220, 220, 219, 219, 218, 218, 218, 217, 217, 216, 216,
+    215, 215, 214, 214, 213, 213, 212, 211, 211, 210, 209, 209, 208, 207, 207, 206,
+    205, 204, 203, 202, 202, 201, 200, 199, 198, 197, 196, 195, 193, 192, 191, 190,
+    189, 188, 186, 185, 184, 182, 181, 180, 178, 177, 175, 174, 172, 171, 169, 168,
+    166, 164, 163, 161, 160, 158, 156, 154, 153, 151, 149, 148, 146, 144, 142, 141,
+    139, 137, 135, 134, 132, 130, 128, 127, 125, 123, 122, 120, 118, 117, 115, 113,
+    112, 110, 109, 107, 106, 104, 103, 101, 100,  99,  97,  96,  94,  93,  92,  91,
+     89,  88,  87,  86,  85,  84,  83,  82,  81,  80,  79,  78,  77,  76,  75,  74,
+     74,  73,  72,  71,  71,  70,  69,  69,  68,  67,  67,  66,  66,  65,  65,  64,
+     64,  63,  63,  62,  62,  61,  61,  61,  60,  60,  60,  59,  59,  59,  58,  58,
+     58,  58,  57,  57,  57,  57,  56,  56,  56,  56,  55,  55,  55,  55,  55,  55,
+     54,  54,  54,  54,  54,  54,  54,  54,  53,  53,  53,  53,  53,  53,  53,  53,
+     53,  53,  52,  52,  52,  52,  52,  52,  52,  52,  52,  52,  52,  52,  52,  52
+  };
+
+  void csma_curve_build(uint8_t slope) {
+    // Only runs when the host changes the curve,
+    // keeping the float math off the MAC path.
+    // The slope is given in steps of 0.1.
+    float s = slope/10.0;
+    for (uint16_t i = 0; i < 256; i++) {
+      float x = exp(s*(i/255.0)-s/2.0);
+      float u = x/(x+1.0);
+      csma_p_curve[i] = (uint8_t)((1.0-(csma_p_min+(csma_p_max-csma_p_min)*u))*255.0);
+    }
+    csma_curve_slope = slope;
+  }
+
   void update_csma_p() {
-      csma_p = (uint8_t)((1.0-(csma_p_min+(csma_p_max-csma_p_min)*csma_slope(airtime)))*255.0);
-}
+    uint16_t i = (airtime <= 0.0) ? 0 : (uint16_t)(airtime*255.0);
+    if (i > 255) i = 255;
+    csma_p = csma_p_curve[i];
+  }
+
+  void csma_backoff() {
+    // Binary exponential backoff. The window
+    // doubles each time the channel is found
+    // busy, and is reset after a transmission.
+    // With backoff off, both exponents are zero
+    // and this waits a single slot.
+    uint16_t window = 1 << csma_be;
+    dcd_waiting = true;
+    dcd_wait_until = millis()+(long)csma_slot_ms*(1+random(window));
+    if (csma_be < csma_be_max) csma_be++;
+  }
+
+  void scan_tune() {
+    // The scan always uses continuous receive,
+    // since RSSI can't be sampled otherwise
+    uint32_t freq = scan_list ? scan_list[scan_index] : scan_start+scan_index*scan_step;
+    modem_lock_take();
+    LoRa->setFrequency(freq);
+    LoRa->receive();
+    modem_lock_give();
+    scan_floor[scan_index] = 0xFF;
+    scan_peak[scan_index] = 0x00;
+    scan_sum[scan_index] = 0;
+    scan_samples[scan_index] = 0;
+    scan_next_sample = micros();
+    scan_until = millis()+scan_dwell_ms;
+  }
+
+  void scan_begin() {
+    modem_lock_take();
+    if (scan_bw != 0) LoRa->setSignalBandwidth(scan_bw);
+    modem_lock_give();
+    scan_index = 0;
+    scan_tune();
+    scan_active = true;
+  }
+
+  void scan_poll() {
+    if ((int32_t)(millis()-scan_until) < 0) {
+      // Sample at a fixed interval, so the count
+      // per channel depends on the dwell time and
+      // not on how fast the main loop runs. After
+      // a stall, sampling resumes without catching
+      // up on the missed samples.
+      uint32_t now = micros();
+      if ((int32_t)(now-scan_next_sample) < 0) return;
+      scan_next_sample += SCAN_SAMPLE_US;
+      if ((int32_t)(now-scan_next_sample) >= 0) scan_next_sample = now+SCAN_SAMPLE_US;
+
+      modem_lock_take();
+      int rssi = LoRa->currentRssi()+rssi_offset;
+      modem_lock_give();
+      if (rssi < 0) rssi = 0;
+      if (rssi > 0xFF) rssi = 0xFF;
+      if (rssi < scan_floor[scan_index]) scan_floor[scan_index] = rssi;
+      if (rssi > scan_peak[scan_index]) scan_peak[scan_index] = rssi;
+      if (scan_samples[scan_index] < 0xFFFF) {
+        scan_sum[scan_index] += rssi;
+        scan_samples[scan_index]++;
+      }
+      return;
+    }
+
+    if (++scan_index < scan_count) {
+      scan_tune();
+      return;
+    }
+
+    // Sweep done, return to the configured
+    // channel and hand the result to the host
+    modem_lock_take();
+    if (scan_bw != 0) LoRa->setSignalBandwidth(lora_bw);
+    LoRa->setFrequency(lora_freq);
+    lora_receive();
+    modem_lock_give();
+    scan_active = false;
+
+    if (scan_autochan) {
+      scan_autochan = false;
+      scan_list = NULL;
+      autochan_evaluate();
+    } else {
+      mac_indicate(MAC_EVT_SPECTRUM);
+    }
+  }
+
+  void autochan_beacon(uint32_t freq) {
+    // Announce the channel change, so peers
+    // can follow at the same time
+    if (airtime_lock) return;
+    modem_lock_take();
+    led_tx_on();
+    LoRa->beginPacket();
+    LoRa->write((random(256) & 0xF0) | FLAG_BEACON);
+    LoRa->write(BEACON_MAGIC_1);
+    LoRa->write(BEACON_MAGIC_2);
+    LoRa->write(freq>>24);
+    LoRa->write(freq>>16);
+    LoRa->write(freq>>8);
+    LoRa->write(freq);
+    LoRa->write(AUTOCHAN_SWITCH_MS>>8);
+    LoRa->write(AUTOCHAN_SWITCH_MS & 0xFF);
+    LoRa->endPacket(); add_airtime(HEADER_L+BEACON_L);
+    lora_receive();
+    led_tx_off();
+    modem_lock_give();
+  }
+
+  void autochan_beacon_rx(int packet_size) {
+    uint8_t beacon[BEACON_L];
+    if (packet_size != BEACON_L) return;
+    for (uint8_t i = 0; i < BEACON_L; i++) beacon[i] = LoRa->read();
+    if (beacon[0] != BEACON_MAGIC_1 || beacon[1] != BEACON_MAGIC_2) return;
+    if (autochan_mode == AUTOCHAN_OFF) return;
+
+    // Only follow to channels the host allowed
+    uint32_t freq = (uint32_t)beacon[2] << 24 | (uint32_t)beacon[3] << 16 | (uint32_t)beacon[4] << 8 | (uint32_t)beacon[5];
+    uint16_t delay_ms = (uint16_t)beacon[6] << 8 | (uint16_t)beacon[7];
+    for (uint8_t i = 0; i < autochan_count; i++) {
+      if (autochan_freqs[i] == freq) {
+        autochan_switch_freq = freq;
+        autochan_switch_at = millis()+delay_ms;
+        autochan_switch_pending = true;
+      }
+    }
+  }
+
+  void autochan_evaluate() {
+    // Each channel is scored by its average RSSI
+    // during the scan, plus a penalty from the
+    // long-term utilisation seen while on it
+    uint8_t current = 0xFF;
+    uint8_t best = 0;
+    for (uint8_t i = 0; i < autochan_count; i++) {
+      uint16_t score = 0xFF;
+      if (scan_samples[i] > 0) {
+        score = scan_sum[i]/scan_samples[i];
+        score += (uint16_t)(autochan_util[i]*AUTOCHAN_UTIL_WEIGHT);
+        if (score > 0xFF) score = 0xFF;
+      }
+      autochan_score[i] = score;
+      if (autochan_score[i] < autochan_score[best]) best = i;
+      if (autochan_freqs[i] == lora_freq) current = i;
+    }
+    autochan_best = best;
+    mac_indicate(MAC_EVT_CHAN);
+
+    if (autochan_mode == AUTOCHAN_MOVE && best != current) {
+      if (current == 0xFF || autochan_score[best]+AUTOCHAN_HYST < autochan_score[current]) {
+        autochan_beacon(autochan_freqs[best]);
+        autochan_switch_freq = autochan_freqs[best];
+        autochan_switch_at = millis()+AUTOCHAN_SWITCH_MS;
+        autochan_switch_pending = true;
+      }
+    }
+  }
+
+  void autochan_poll() {
+    uint32_t now = millis();
+    if (autochan_switch_pending && (int32_t)(now-autochan_switch_at) >= 0) {
+      autochan_switch_pending = false;
+      modem_lock_take();
+      lora_freq = autochan_switch_freq;
+      setFrequency();
+      lora_receive();
+      modem_lock_give();
+      init_channel_stats();
+      mac_indicate(MAC_EVT_FREQ);
+    }
+
+    if (autochan_mode == AUTOCHAN_OFF || autochan_count == 0 || hop_count != 0) return;
+    if (scan_active || scan_requested || autochan_switch_pending || queue_height > 0 || sched_pending) return;
+    if ((int32_t)(now-autochan_next) < 0) return;
+
+    // The host sets up its own scans while
+    // holding the modem lock, so the check is
+    // repeated under it
+    modem_lock_take();
+    if (scan_requested) { modem_lock_give(); return; }
+
+    uint32_t interval_ms = autochan_interval_min ? (uint32_t)autochan_interval_min*60000 : AUTOCHAN_INTERVAL_MS;
+    autochan_next = now+interval_ms;
+
+    // Keep the long-term utilisation of the
+    // current channel for its next scoring
+    for (uint8_t i = 0; i < autochan_count; i++) {
+      if (autochan_freqs[i] == lora_freq) autochan_util[i] = longterm_channel_util;
+    }
+
+    scan_list = autochan_freqs;
+    scan_count = autochan_count;
+    scan_dwell_ms = AUTOCHAN_DWELL_MS;
+    scan_bw = 0;
+    scan_autochan = true;
+    scan_begin();
+    modem_lock_give();
+  }
+
+  void hop_configure(uint16_t dwell_ms, uint16_t seed, uint8_t count) {
+    // Derive the hop order from the seed, as a
+    // shuffle of the table, so all nodes using
+    // the same seed visit channels in the same
+    // order and each channel once per cycle
+    hop_dwell_ms = dwell_ms < HOP_DWELL_MIN_MS ? HOP_DWELL_MIN_MS : dwell_ms;
+    hop_seed = seed;
+    uint32_t x = seed;
+    for (uint8_t i = 0; i < count; i++) { hop_order[i] = i; hop_airtime_ms[i] = 0; }
+    for (uint8_t i = count; i > 1; i--) {
+      x = x*1103515245+12345;
+      uint8_t j = (x >> 16) % i;
+      uint8_t t = hop_order[i-1]; hop_order[i-1] = hop_order[j]; hop_order[j] = t;
+    }
+    hop_synced = false;
+    hop_count = count;
+  }
+
+  void hop_tune(uint8_t position) {
+    uint8_t index = hop_order[position];
+    if (index == hop_index && lora_freq == hop_freqs[index]) return;
+    modem_lock_take();
+    hop_index = index;
+    lora_freq = hop_freqs[index];
+    LoRa->setFrequency(lora_freq);
+    lora_receive();
+    modem_lock_give();
+  }
+
+  void hop_reload_table() {
+    // Swap in the table staged by the host. All
+    // live hop state is only changed while the
+    // modem lock is held.
+    hop_reload = false;
+    hop_count = 0;
+    for (uint8_t i = 0; i < hop_next_count; i++) hop_freqs[i] = hop_next_freqs[i];
+    if (hop_next_count > 0) hop_configure(hop_next_dwell_ms, hop_next_seed, hop_next_count);
+    mac_indicate(MAC_EVT_HOP);
+  }
+
+  void hop_poll() {
+    modem_lock_take();
+    if (hop_reload) hop_reload_table();
+    if (scan_active) { modem_lock_give(); return; }
+
+    uint8_t count = hop_count;
+    if (count != 0) {
+      if (hop_synced && (int32_t)(millis()-hop_sync_until) >= 0) hop_synced = false;
+
+      // Unsynced nodes wait on the first channel
+      // of the order, and a packet that is being
+      // received is never cut off by a hop
+      if (!dcd) {
+        if (!hop_synced) { hop_tune(0); }
+        else { hop_tune(((millis()-hop_epoch)/hop_dwell_ms) % count); }
+      }
+    }
+    modem_lock_give();
+  }
+
+  void hop_sync(uint8_t position, uint16_t elapsed_ms, uint16_t length) {
+    // Align to the sender's slots, taking into
+    // account that the slot position was sent
+    // at the start of the packet
+    uint32_t airtime_us = (uint32_t)(((uint64_t)length*lora_byte_time_ns)/1000)+lora_overhead_us;
+    uint32_t now = millis();
+    hop_epoch = now-(uint32_t)position*hop_dwell_ms-elapsed_ms-airtime_us/1000;
+    hop_sync_until = now+HOP_SYNC_TIMEOUT_MS;
+    hop_synced = true;
+  }
+
+  uint32_t hop_tx_prepare() {
+    // Move to the channel of the current slot,
+    // starting this node's own slots if it is not
+    // synced to anyone, on the channel where
+    // unsynced nodes listen. If the queued frames
+    // won't fit in what is left of the slot, the
+    // time until the next slot is returned.
+    modem_lock_take();
+    if (hop_count == 0) { modem_lock_give(); return 0; }
+    uint32_t now = millis();
+    if (!hop_synced) { hop_epoch = now; hop_synced = true; }
+    hop_sync_until = now+HOP_SYNC_TIMEOUT_MS;
+    hop_tx_slot = (now-hop_epoch)/hop_dwell_ms;
+    hop_tune(hop_tx_slot % hop_count);
+    uint32_t left_ms = hop_epoch+(hop_tx_slot+1)*hop_dwell_ms-now;
+    modem_lock_give();
+
+    // Frames that can't fit in any slot are sent
+    // as soon as the channel is free
+    uint32_t need_ms = (uint32_t)(((uint64_t)queued_bytes*lora_byte_time_ns)/1000000);
+    need_ms += (uint32_t)queue_height*(lora_overhead_us/1000) + dcd_threshold*2*STATUS_INTERVAL_MS;
+    if (need_ms >= hop_dwell_ms || need_ms <= left_ms) return 0;
+    return left_ms;
+  }
+
+  bool hop_tx_current() {
+    // The slot can move on, or a received packet
+    // can shift it, while the channel is sensed
+    if (hop_count == 0) return true;
+    return (millis()-hop_epoch)/hop_dwell_ms == hop_tx_slot;
+  }
+
+  void hop_write_header() {
+    uint32_t elapsed_ms = millis()-hop_epoch-hop_tx_slot*hop_dwell_ms;
+    if (elapsed_ms > 0xFFFF) elapsed_ms = 0xFFFF;
+    LoRa->write(hop_tx_slot % hop_count);
+    LoRa->write(elapsed_ms >> 8);
+    LoRa->write(elapsed_ms & 0xFF);
+  }
+
+  bool csma_cad() {
+    // Time the CAD run, so the slot length
+    // tracks what the modem actually needs
+    modem_lock_take();
+    uint32_t cad_start = micros();
+    bool detected = LoRa->channelActivityDetect(LORA_CAD_SYMBOLS);
+    uint32_t cad_us = micros()-cad_start;
+    if (detected) lora_receive();
+    modem_lock_give();
+
+    if (csma_cad_us == 0) { csma_cad_us = cad_us; }
+    else { csma_cad_us = (csma_cad_us*7+cad_us)/8; }
+    update_csma_slot();
+    return detected;
+  }
 #endif
 
 void loop() {
   if (radio_online) {
     #if MCU_VARIANT == MCU_ESP32
-      if (packet_ready) {
-        portENTER_CRITICAL(&update_lock);
-        last_rssi = LoRa->packetRssi();
-        last_snr_raw = LoRa->packetSnrRaw();
-        portEXIT_CRITICAL(&update_lock);
-        kiss_indicate_stat_rssi();
-        kiss_indicate_stat_snr();
-        kiss_write_packet();
-      }
-
       airtime_lock = false;
       if (st_airtime_limit != 0.0 && airtime >= st_airtime_limit) airtime_lock = true;
       if (lt_airtime_limit != 0.0 && longterm_airtime >= lt_airtime_limit) airtime_lock = true;
 
-    #elif MCU_VARIANT == MCU_NRF52
-      if (packet_ready) {
-        portENTER_CRITICAL();
-        last_rssi = LoRa->packetRssi();
-        last_snr_raw = LoRa->packetSnrRaw();
-        portEXIT_CRITICAL();
-        kiss_indicate_stat_rssi();
-        kiss_indicate_stat_snr();
-        kiss_write_packet();
-      }
+      if (rx_duty && !rx_duty_hw && queue_height == 0 && !scan_active) rx_sniff();
+      if (scan_requested) { scan_begin(); scan_requested = false; }
+      if (scan_active) scan_poll();
+      autochan_poll();
+      hop_poll();
 
+    #elif MCU_VARIANT == MCU_NRF52
       airtime_lock = false;
       if (st_airtime_limit != 0.0 && airtime >= st_airtime_limit) airtime_lock = true;
       if (lt_airtime_limit != 0.0 && longterm_airtime >= lt_airtime_limit) airtime_lock = true;
+
+      if (rx_duty && !rx_duty_hw && queue_height == 0 && !scan_active) rx_sniff();
+      if (scan_requested) { scan_begin(); scan_requested = false; }
+      if (scan_active) scan_poll();
+      autochan_poll();
+      hop_poll();
     #endif
 
-    checkModemStatus();
-    if (!airtime_lock) {
+    #if MCU_VARIANT == MCU_ESP32 || MCU_VARIANT == MCU_NRF52
+      // Transmissions and status polling are
+      // held back while a scan is running
+      bool mac_paused = scan_active;
+    #else
+      bool mac_paused = false;
+    #endif
+
+    // Polling the modem status over SPI would
+    // wake a duty-cycled modem, so it is skipped
+    if (!rx_duty && !mac_paused) checkModemStatus();
+    if (!airtime_lock && !mac_paused) {
       if (queue_height > 0) {
         #if MCU_VARIANT == MCU_ESP32 || MCU_VARIANT == MCU_NRF52
           long check_time = millis();
-          if (check_time > post_tx_yield_timeout) {
+          if (check_time > post_tx_yield_timeout && !sched_blocks_flush()) {
             if (dcd_waiting && (check_time >= dcd_wait_until)) { dcd_waiting = false; }
+
+            // While hopping, move to the channel of the
+            // current slot before sensing it, or wait
+            // for the next slot if this one is too short
+            if (!dcd_waiting && csma_state == CSMA_IDLE && hop_count != 0) {
+              uint32_t hop_wait_ms = hop_tx_prepare();
+              if (hop_wait_ms != 0) {
+                dcd_waiting = true;
+                dcd_wait_until = check_time+hop_wait_ms;
+              }
+            }
+
+            bool lbt = cad_lbt || rx_duty;
             if (!dcd_waiting) {
-              for (uint8_t dcd_i = 0; dcd_i < dcd_threshold*2; dcd_i++) {
-                delay(STATUS_INTERVAL_MS); updateModemStatus();
+              bool sensed = true;
+              if (!lbt) {
+                // Sample the modem status once per
+                // status interval, returning to the
+                // main loop in between samples
+                if (csma_state == CSMA_IDLE) {
+                  csma_state = CSMA_SENSING;
+                  csma_samples = 0;
+                  csma_next_sample = check_time+STATUS_INTERVAL_MS;
+                }
+
+                sensed = false;
+                if ((int32_t)(check_time-csma_next_sample) >= 0) {
+                  updateModemStatus();
+                  csma_next_sample = check_time+STATUS_INTERVAL_MS;
+                  if (++csma_samples >= dcd_threshold*2) {
+                    csma_state = CSMA_IDLE;
+                    sensed = true;
+                  }
+                }
+              } else if (!dcd) {
+                // Run hardware CAD right before
+                // transmitting instead of sampling
+                // the modem status
+                if (csma_cad()) csma_backoff();
               }
 
-              if (!dcd) {
+              // Without backoff, a busy channel is
+              // sensed again right away
+              if (sensed && dcd && !dcd_waiting && csma_be_max != 0) csma_backoff();
+
+              if (sensed && !dcd && !dcd_waiting) {
                 uint8_t csma_r = (uint8_t)random(256);
                 if (csma_p >= csma_r) {
-                  flushQueue();
+                  // Only send on the channel that was
+                  // sensed, or sense the new one first
+                  if (hop_tx_current()) flushQueue();
                 } else {
+                  if (lbt) lora_receive();
                   dcd_waiting = true;
                   dcd_wait_until = millis()+csma_slot_ms;
                 }
@@ -1254,17 +2539,31 @@ void loop() {
           if (!dcd_waiting) updateModemStatus();
 
           if (!dcd && !dcd_led) {
-            if (dcd_waiting) delay(lora_rx_turnaround_ms);
+            if (dcd_waiting && csma_state == CSMA_IDLE) {
+              // Wait out the receive turnaround
+              // time while serial is still served
+              csma_state = CSMA_SENSING;
+              dcd_wait_until = millis()+lora_rx_turnaround_ms;
+            }
 
-            updateModemStatus();
+            if (csma_state != CSMA_SENSING || (long)millis() >= dcd_wait_until) {
+              csma_state = CSMA_IDLE;
+              updateModemStatus();
 
-            if (!dcd) {
-              dcd_waiting = false;
-              flushQueue();
+              if (!dcd) {
+                if (cad_lbt && LoRa->channelActivityDetect(LORA_CAD_SYMBOLS)) {
+                  lora_receive();
+                  dcd_waiting = true;
+                } else {
+                  dcd_waiting = false;
+                  flushQueue();
+                }
+              }
             }
 
           } else {
             dcd_waiting = true;
+            csma_state = CSMA_IDLE;
           }
         #endif
       }
@@ -1286,7 +2585,19 @@ void loop() {
     }
   }
 
+  #if MCU_VARIANT != MCU_ESP32
+    host_poll();
+  #endif
+
+  #if MCU_VARIANT == MCU_ESP32 || MCU_VARIANT == MCU_NRF52
+    if (rx_duty && radio_online && queue_height == 0 && rx_pool_empty() && !sched_pending) delay(RX_DUTY_IDLE_MS);
+  #endif
+}
+
+void host_poll() {
   #if MCU_VARIANT == MCU_ESP32 || MCU_VARIANT == MCU_NRF52
+      rx_pool_drain();
+      mac_events_flush();
       buffer_serial();
       if (!fifo_isempty(&serialFIFO)) serial_poll();
   #else
@@ -1310,6 +2621,19 @@ void loop() {
   #endif
 }
 
+#if MCU_VARIANT == MCU_ESP32
+  void host_task(void *param) {
+    while (true) {
+      host_poll();
+      vTaskDelay(1);
+    }
+  }
+
+  void host_task_start() {
+    xTaskCreatePinnedToCore(host_task, "host", 8192, NULL, HOST_TASK_PRIORITY, &host_task_handle, HOST_TASK_CORE);
+  }
+#endif
+
 void sleep_now() {
   #if HAS_SLEEP == true
     #if BOARD_MODEL == BOARD_RNODE_NG_22
@@ -1341,7 +2665,16 @@ void serial_poll() {
   while (!fifo_isempty(&serialFIFO)) {
   #endif
     char sbyte = fifo_pop(&serialFIFO);
-    serialCallback(sbyte);
+    #if MCU_VARIANT == MCU_ESP32 || MCU_VARIANT == MCU_NRF52
+      // Payload bytes are only queued, but any
+      // other command may reconfigure the modem
+      bool lock = (command != CMD_DATA);
+      if (lock) modem_lock_take();
+      serialCallback(sbyte);
+      if (lock) modem_lock_give();
+    #else
+      serialCallback(sbyte);
+    #endif
   }
 
   serial_polling = false;
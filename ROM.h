@@ -69,6 +69,7 @@
 	#define ADDR_CONF_BW   0x9F
 	#define ADDR_CONF_FREQ 0xA3
 	#define ADDR_CONF_OK   0xA7
+	#define ADDR_CONF_SYNC 0xA8
 	
 	#define ADDR_CONF_BT   0xB0
 	#define ADDR_CONF_DSET 0xB1
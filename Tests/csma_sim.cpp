@@ -0,0 +1,288 @@
+// Copyright (C) 2023, Mark Qvist
+
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+// Host-side contention simulation of the CSMA
+// MAC in loop(), comparing the slot derived from
+// the symbol time and binary exponential backoff
+// against the fixed slot the MAC used before.
+// All nodes hear each other. Run with "make test".
+
+#include <stdio.h>
+#include <algorithm>
+#include <vector>
+#include "../Phy.h"
+
+// Mirrors of the MAC parameters in Config.h
+#define STATUS_INTERVAL_MS   3
+#define DCD_THRESHOLD        2
+#define POST_TX_YIELD_SLOTS  6
+#define CSMA_SLOT_DEFAULT_MS 50
+#define CSMA_SLOT_SYMBOLS    10
+#define CSMA_SLOT_MIN_MS     5
+#define CSMA_SLOT_MAX_MS     1000
+#define PREAMBLE_TARGET_MS   15
+#define PREAMBLE_SYMBOLS_MIN 18
+#define PREAMBLE_SYMBOLS_HW  4
+
+// Persistence at low airtime, the first entry
+// of the default csma_p_curve
+#define CSMA_P               228
+
+// Preamble symbols the modem needs before it
+// reports a signal as detected
+#define DETECT_SYMBOLS       5
+
+#define PAYLOAD_BYTES        50
+#define PACKETS_PER_RUN      1000
+#define RUNS                 3
+
+struct mac_config {
+  const char *name;
+  bool derived_slot;
+  uint8_t be_min;
+  uint8_t be_max;
+};
+
+struct packet {
+  uint32_t arrival;
+  uint32_t start;
+  uint32_t end;
+  int node;
+};
+
+struct burst {
+  uint32_t start;
+  uint32_t end;
+};
+
+struct node {
+  std::vector<uint32_t> queue;
+  burst last;
+  uint32_t tx_end;
+  uint32_t yield_until;
+  uint32_t wait_until;
+  uint32_t next_sample;
+  uint8_t samples;
+  uint8_t be;
+  bool waiting;
+  bool sensing;
+};
+
+struct result {
+  double throughput;
+  double latency_ms;
+  double collided;
+};
+
+static uint32_t rng_state;
+static uint32_t rng() {
+  rng_state = rng_state*1103515245+12345;
+  return rng_state >> 8;
+}
+
+static bool starts_before(const packet &a, const packet &b) {
+  return a.start < b.start;
+}
+
+static uint32_t slot_ms(const mac_config &mac, uint32_t symbol_time_ns) {
+  if (!mac.derived_slot) return CSMA_SLOT_DEFAULT_MS;
+  uint32_t slot = ((symbol_time_ns/1000)*CSMA_SLOT_SYMBOLS+999)/1000;
+  if (slot < CSMA_SLOT_MIN_MS) slot = CSMA_SLOT_MIN_MS;
+  if (slot > CSMA_SLOT_MAX_MS) slot = CSMA_SLOT_MAX_MS;
+  return slot;
+}
+
+static result simulate(const mac_config &mac, uint8_t sf, int nodes, double load, uint32_t seed) {
+  uint32_t bw = 125000;
+  uint32_t symbol_time_ns = phy_symbol_time_ns(sf, bw);
+  uint32_t preamble = (PREAMBLE_TARGET_MS*1000000+symbol_time_ns-1)/symbol_time_ns;
+  preamble = preamble < PREAMBLE_SYMBOLS_MIN+PREAMBLE_SYMBOLS_HW ? PREAMBLE_SYMBOLS_MIN : preamble-PREAMBLE_SYMBOLS_HW;
+  uint32_t airtime_us = phy_overhead_us(preamble, symbol_time_ns);
+  airtime_us += (uint32_t)(((uint64_t)(PAYLOAD_BYTES+1)*phy_byte_time_ns(sf, 5, bw))/1000);
+  uint32_t airtime_ms = (airtime_us+999)/1000;
+  uint32_t slot = slot_ms(mac, symbol_time_ns);
+
+  // A carrier is seen once enough preamble has
+  // passed for consecutive detections, and is
+  // held for a slot after it ends
+  uint32_t detect_ms = (DETECT_SYMBOLS*symbol_time_ns)/1000000;
+  if (detect_ms < DCD_THRESHOLD*STATUS_INTERVAL_MS) detect_ms = DCD_THRESHOLD*STATUS_INTERVAL_MS;
+
+  // Offered load in channel airtime, spread
+  // evenly over all nodes as Poisson arrivals
+  uint32_t duration_ms = (uint32_t)(PACKETS_PER_RUN*airtime_ms/load);
+  uint32_t arrival_p = (uint32_t)((load/airtime_ms/nodes)*0x1000000);
+
+  rng_state = seed;
+  std::vector<node> n(nodes);
+  std::vector<packet> sent;
+  for (int i = 0; i < nodes; i++) {
+    node &s = n[i];
+    s.last.start = s.last.end = 0;
+    s.tx_end = s.yield_until = s.wait_until = s.next_sample = 0;
+    s.samples = 0; s.be = mac.be_min;
+    s.waiting = s.sensing = false;
+  }
+
+  for (uint32_t now = 1; now < duration_ms; now++) {
+    for (int i = 0; i < nodes; i++) {
+      node &s = n[i];
+      if (rng() < arrival_p) s.queue.push_back(now);
+      if (now < s.tx_end || s.queue.empty() || now <= s.yield_until) continue;
+
+      if (s.waiting && now >= s.wait_until) s.waiting = false;
+      if (s.waiting) continue;
+
+      if (!s.sensing) {
+        s.sensing = true;
+        s.samples = 0;
+        s.next_sample = now+STATUS_INTERVAL_MS;
+      }
+      if (now < s.next_sample) continue;
+      s.next_sample = now+STATUS_INTERVAL_MS;
+      if (++s.samples < DCD_THRESHOLD*2) continue;
+      s.sensing = false;
+
+      bool dcd = false;
+      for (int j = 0; j < nodes && !dcd; j++) {
+        if (j == i) continue;
+        const burst &b = n[j].last;
+        if (b.end > b.start && b.start+detect_ms < b.end && now >= b.start+detect_ms && now < b.end+slot) dcd = true;
+      }
+
+      if (dcd) {
+        // Without backoff, the channel is sensed
+        // again on the next pass of the loop
+        if (mac.be_max != 0) {
+          s.waiting = true;
+          s.wait_until = now+slot*(1+rng()%(1 << s.be));
+          if (s.be < mac.be_max) s.be++;
+        }
+        continue;
+      }
+
+      if ((rng() & 0xFF) <= CSMA_P) {
+        // The whole queue goes out back to back
+        uint32_t t = now;
+        for (size_t k = 0; k < s.queue.size(); k++) {
+          packet p = { s.queue[k], t, t+airtime_ms, i };
+          sent.push_back(p);
+          t += airtime_ms;
+        }
+        s.queue.clear();
+        s.last.start = now;
+        s.last.end = t;
+        s.tx_end = t;
+        s.yield_until = t+POST_TX_YIELD_SLOTS*slot;
+        s.be = mac.be_min;
+      } else {
+        s.waiting = true;
+        s.wait_until = now+slot;
+      }
+    }
+  }
+
+  // All packets have the same airtime, so once
+  // sorted by start, only packets starting less
+  // than one airtime apart can overlap
+  std::sort(sent.begin(), sent.end(), starts_before);
+  uint64_t delivered_ms = 0;
+  uint64_t latency_ms = 0;
+  uint32_t delivered = 0;
+  for (size_t k = 0; k < sent.size(); k++) {
+    bool collided = false;
+    for (size_t m = k; m-- > 0 && sent[m].end > sent[k].start && !collided;) {
+      if (sent[m].node != sent[k].node) collided = true;
+    }
+    for (size_t m = k+1; m < sent.size() && sent[m].start < sent[k].end && !collided; m++) {
+      if (sent[m].node != sent[k].node) collided = true;
+    }
+    if (!collided) {
+      delivered++;
+      delivered_ms += airtime_ms;
+      latency_ms += sent[k].end-sent[k].arrival;
+    }
+  }
+
+  result r;
+  r.throughput = (double)delivered_ms/duration_ms;
+  r.latency_ms = delivered ? (double)latency_ms/delivered : 0.0;
+  r.collided = sent.size() ? 1.0-(double)delivered/sent.size() : 0.0;
+  return r;
+}
+
+static result average(const mac_config &mac, uint8_t sf, int nodes, double load) {
+  result sum = { 0.0, 0.0, 0.0 };
+  for (uint32_t run = 0; run < RUNS; run++) {
+    result r = simulate(mac, sf, nodes, load, 0x5EED+run);
+    sum.throughput += r.throughput/RUNS;
+    sum.latency_ms += r.latency_ms/RUNS;
+    sum.collided += r.collided/RUNS;
+  }
+  return sum;
+}
+
+static int failures = 0;
+
+static void check(const char *name, uint8_t sf, int nodes, double load, bool ok) {
+  if (!ok) {
+    printf("FAIL %s sf=%u nodes=%d load=%.1f\n", name, sf, nodes, load);
+    failures++;
+  }
+}
+
+int main() {
+  const mac_config legacy = { "fixed slot", false, 0, 0 };
+  const mac_config derived = { "derived slot, BEB", true, 1, 6 };
+  const uint8_t sfs[] = { 7, 9, 12 };
+  const int node_counts[] = { 3, 10 };
+  const double loads[] = { 0.3, 0.6 };
+  int checks = 0;
+
+  printf("sf nodes load | %-26s | %-26s\n", legacy.name, derived.name);
+  for (unsigned int i = 0; i < sizeof(sfs); i++) {
+    for (unsigned int j = 0; j < sizeof(node_counts)/sizeof(node_counts[0]); j++) {
+      for (unsigned int k = 0; k < sizeof(loads)/sizeof(loads[0]); k++) {
+        uint8_t sf = sfs[i];
+        int nodes = node_counts[j];
+        double load = loads[k];
+        result a = average(legacy, sf, nodes, load);
+        result b = average(derived, sf, nodes, load);
+        printf("%2u %5d %4.1f | S=%.3f L=%6.0fms C=%.2f | S=%.3f L=%6.0fms C=%.2f\n",
+          sf, nodes, load, a.throughput, a.latency_ms, a.collided, b.throughput, b.latency_ms, b.collided);
+
+        // Backoff must never cost throughput or
+        // add collisions. Latency may grow with the
+        // longer slots at slow rates, but only up to
+        // a bound at moderate load. Under heavy load
+        // it is reported, not checked.
+        check("throughput", sf, nodes, load, b.throughput >= a.throughput-0.01);
+        check("collisions", sf, nodes, load, b.collided <= a.collided+0.01);
+        checks += 2;
+        if (load < 0.5) {
+          check("latency", sf, nodes, load, b.latency_ms <= a.latency_ms*1.5);
+          checks++;
+        }
+      }
+    }
+  }
+
+  if (failures) {
+    printf("%d of %d checks failed\n", failures, checks);
+    return 1;
+  }
+  printf("All %d CSMA simulation checks passed\n", checks);
+  return 0;
+}
@@ -0,0 +1,76 @@
+// Copyright (C) 2023, Mark Qvist
+
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+// Host-side check of the integer PHY model in
+// Phy.h against the floating point reference
+// it replaced. Run with "make test".
+
+#include <math.h>
+#include <stdio.h>
+#include "../Phy.h"
+
+static const uint32_t bandwidths[] = {
+  7800, 10400, 15600, 20800, 31250, 41700, 62500, 125000,
+  203125, 250000, 406250, 500000, 812500, 1625000
+};
+
+static int failures = 0;
+
+static void check(const char *name, uint8_t sf, uint8_t cr, uint32_t bw, double value, double reference, double tolerance) {
+  if (fabs(value-reference) > tolerance) {
+    printf("FAIL %s sf=%u cr=%u bw=%lu: got %.3f, expected %.3f\n", name, sf, cr, (unsigned long)bw, value, reference);
+    failures++;
+  }
+}
+
+int main() {
+  int checks = 0;
+  for (uint8_t sf = 5; sf <= 12; sf++) {
+    for (uint8_t cr = 5; cr <= 8; cr++) {
+      for (unsigned int i = 0; i < sizeof(bandwidths)/sizeof(bandwidths[0]); i++) {
+        uint32_t bw = bandwidths[i];
+        double symbol_rate = (double)bw/pow(2, sf);
+        double symbol_time_ns = 1e9/symbol_rate;
+        double bitrate = sf*(4.0/cr)*symbol_rate;
+        double byte_time_ns = 8e9/bitrate;
+
+        // Integer results truncate, so they may
+        // be at most one unit below the reference
+        uint32_t sym_ns = phy_symbol_time_ns(sf, bw);
+        check("symbol_time_ns", sf, cr, bw, sym_ns, symbol_time_ns, 1.0);
+        check("byte_time_ns", sf, cr, bw, phy_byte_time_ns(sf, cr, bw), byte_time_ns, 1.0);
+        check("bitrate", sf, cr, bw, phy_bitrate(sf, cr, bw), bitrate, 1.0);
+
+        for (uint32_t preamble = 6; preamble <= 0xFFFF; preamble *= 4) {
+          double overhead_us = (preamble+4.25+PHY_HEADER_LORA_SYMBOLS)*symbol_time_ns/1000.0;
+          if (overhead_us > 0xFFFFFFFF) overhead_us = 0xFFFFFFFF;
+          // Allow for the truncated symbol time
+          // being multiplied by the symbol count
+          double tolerance = 1.0+(preamble+4.25+PHY_HEADER_LORA_SYMBOLS)/1000.0;
+          check("overhead_us", sf, cr, bw, phy_overhead_us(preamble, sym_ns), overhead_us, tolerance);
+          checks++;
+        }
+        checks += 3;
+      }
+    }
+  }
+
+  if (failures) {
+    printf("%d of %d checks failed\n", failures, checks);
+    return 1;
+  }
+  printf("All %d PHY model checks passed\n", checks);
+  return 0;
+}
@@ -14,6 +14,7 @@
 // along with this program.  If not, see <https://www.gnu.org/licenses/>.
 
 #include "Config.h"
+#include "Phy.h"
 
 #if HAS_EEPROM 
     #include <EEPROM.h>
@@ -685,6 +686,18 @@ void kiss_indicate_stat_rx() {
 	serial_write(FEND);
 }
 
+void kiss_indicate_stat_rxpool() {
+	serial_write(FEND);
+	serial_write(CMD_STAT_RXPOOL);
+	escaped_serial_write(rx_pool_overflows>>24);
+	escaped_serial_write(rx_pool_overflows>>16);
+	escaped_serial_write(rx_pool_overflows>>8);
+	escaped_serial_write(rx_pool_overflows);
+	escaped_serial_write(RX_POOL_SLOTS);
+	escaped_serial_write(rx_pool_peak);
+	serial_write(FEND);
+}
+
 void kiss_indicate_stat_tx() {
 	serial_write(FEND);
 	serial_write(CMD_STAT_TX);
@@ -710,6 +723,27 @@ void kiss_indicate_stat_snr() {
 	serial_write(FEND);
 }
 
+void kiss_indicate_stat_time() {
+	uint32_t now = micros();
+	serial_write(FEND);
+	serial_write(CMD_STAT_TIME);
+	escaped_serial_write(now>>24);
+	escaped_serial_write(now>>16);
+	escaped_serial_write(now>>8);
+	escaped_serial_write(now);
+	serial_write(FEND);
+}
+
+void kiss_indicate_stat_txts() {
+	serial_write(FEND);
+	serial_write(CMD_STAT_TXTS);
+	escaped_serial_write(last_tx_us>>24);
+	escaped_serial_write(last_tx_us>>16);
+	escaped_serial_write(last_tx_us>>8);
+	escaped_serial_write(last_tx_us);
+	serial_write(FEND);
+}
+
 void kiss_indicate_radio_lock() {
 	serial_write(FEND);
 	serial_write(CMD_RADIO_LOCK);
@@ -805,10 +839,11 @@ void kiss_indicate_channel_stats() {
 
 void kiss_indicate_phy_stats() {
 	#if MCU_VARIANT == MCU_ESP32
-		uint16_t lst = (uint16_t)(lora_symbol_time_ms*1000);
-		uint16_t lsr = (uint16_t)(lora_symbol_rate);
+		uint16_t lst = (uint16_t)(lora_symbol_time_ns/1000);
+		uint16_t lsr = (uint16_t)(lora_bw >> lora_sf);
+		if (lora_modulation != MODULATION_LORA) lsr = (uint16_t)(lora_bitrate/8 > 0xFFFF ? 0xFFFF : lora_bitrate/8);
 		uint16_t prs = (uint16_t)(lora_preamble_symbols+4);
-		uint16_t prt = (uint16_t)((lora_preamble_symbols+4)*lora_symbol_time_ms);
+		uint16_t prt = (uint16_t)(((uint64_t)(lora_preamble_symbols+4)*lora_symbol_time_ns)/1000000);
 		uint16_t cst = (uint16_t)(csma_slot_ms);
 		serial_write(FEND);
 		serial_write(CMD_STAT_PHYPRM);
@@ -965,6 +1000,265 @@ void kiss_indicate_promisc() {
 	serial_write(FEND);
 }
 
+void kiss_indicate_rx_meta() {
+	serial_write(FEND);
+	serial_write(CMD_RX_META);
+	if (rx_meta) {
+		serial_write(0x01);
+	} else {
+		serial_write(0x00);
+	}
+	serial_write(FEND);
+}
+
+void kiss_indicate_lbt() {
+	serial_write(FEND);
+	serial_write(CMD_LBT);
+	if (cad_lbt) {
+		serial_write(0x01);
+	} else {
+		serial_write(0x00);
+	}
+	serial_write(FEND);
+}
+
+void kiss_indicate_modulation() {
+	serial_write(FEND);
+	serial_write(CMD_MODULATION);
+	serial_write(lora_modulation);
+	serial_write(FEND);
+}
+
+void kiss_indicate_sync_word() {
+	serial_write(FEND);
+	serial_write(CMD_SYNC_WORD);
+	escaped_serial_write(lora_sync_word);
+	serial_write(FEND);
+}
+
+void kiss_indicate_rx_duty() {
+	serial_write(FEND);
+	serial_write(CMD_RX_DUTY);
+	escaped_serial_write(rx_duty_rx_ms>>8);
+	escaped_serial_write(rx_duty_rx_ms);
+	escaped_serial_write(rx_duty_sleep_ms>>8);
+	escaped_serial_write(rx_duty_sleep_ms);
+	serial_write(FEND);
+}
+
+void kiss_indicate_tx_wake() {
+	serial_write(FEND);
+	serial_write(CMD_TX_WAKE);
+	escaped_serial_write(tx_wake_ms>>8);
+	escaped_serial_write(tx_wake_ms);
+	serial_write(FEND);
+}
+
+void kiss_indicate_csma_params() {
+	uint16_t cst = (uint16_t)csma_slot_ms;
+	serial_write(FEND);
+	serial_write(CMD_CSMA_PARAMS);
+	escaped_serial_write(csma_slot_fixed_ms>>8);
+	escaped_serial_write(csma_slot_fixed_ms);
+	escaped_serial_write(csma_be_min);
+	escaped_serial_write(csma_be_max);
+	escaped_serial_write(cst>>8);
+	escaped_serial_write(cst);
+	escaped_serial_write(csma_be);
+	serial_write(FEND);
+}
+
+void kiss_indicate_csma_curve() {
+	serial_write(FEND);
+	serial_write(CMD_CSMA_CURVE);
+	escaped_serial_write(csma_curve_slope);
+	escaped_serial_write((uint8_t)(csma_p_min*255.0));
+	escaped_serial_write((uint8_t)(csma_p_max*255.0));
+	serial_write(FEND);
+}
+
+void kiss_indicate_stations() {
+	serial_write(FEND);
+	serial_write(CMD_STATIONS);
+	#if MCU_VARIANT == MCU_ESP32 || MCU_VARIANT == MCU_NRF52
+		escaped_serial_write(station_key_offset);
+		escaped_serial_write(station_key_len);
+	#else
+		serial_write(0x00);
+		serial_write(0x00);
+	#endif
+	serial_write(FEND);
+}
+
+void kiss_indicate_stat_stations() {
+	#if MCU_VARIANT == MCU_ESP32 || MCU_VARIANT == MCU_NRF52
+		// One record per station: key, packet
+		// count, airtime in ms, RSSI and SNR
+		serial_write(FEND);
+		serial_write(CMD_STAT_STATIONS);
+		escaped_serial_write(station_key_len);
+		for (uint8_t i = 0; i < STATION_SLOTS; i++) {
+			station_t *st = &stations[i];
+			if (!st->used) continue;
+			uint32_t airtime_ms = st->airtime_us/1000;
+			for (uint8_t k = 0; k < station_key_len; k++) escaped_serial_write(st->key[k]);
+			escaped_serial_write(st->packets>>24);
+			escaped_serial_write(st->packets>>16);
+			escaped_serial_write(st->packets>>8);
+			escaped_serial_write(st->packets);
+			escaped_serial_write(airtime_ms>>24);
+			escaped_serial_write(airtime_ms>>16);
+			escaped_serial_write(airtime_ms>>8);
+			escaped_serial_write(airtime_ms);
+			escaped_serial_write((uint8_t)(st->rssi+rssi_offset));
+			escaped_serial_write(st->snr_raw);
+		}
+		serial_write(FEND);
+	#endif
+}
+
+void kiss_indicate_spectrum() {
+	#if MCU_VARIANT == MCU_ESP32 || MCU_VARIANT == MCU_NRF52
+		// Start frequency, step and channel count,
+		// then the RSSI floor and peak per channel
+		// and the number of samples they came from
+		serial_write(FEND);
+		serial_write(CMD_STAT_SPECTRUM);
+		escaped_serial_write(scan_start>>24);
+		escaped_serial_write(scan_start>>16);
+		escaped_serial_write(scan_start>>8);
+		escaped_serial_write(scan_start);
+		escaped_serial_write(scan_step>>24);
+		escaped_serial_write(scan_step>>16);
+		escaped_serial_write(scan_step>>8);
+		escaped_serial_write(scan_step);
+		escaped_serial_write(scan_count);
+		for (uint8_t i = 0; i < scan_count; i++) {
+			escaped_serial_write(scan_floor[i]);
+			escaped_serial_write(scan_peak[i]);
+			escaped_serial_write(scan_samples[i]>>8);
+			escaped_serial_write(scan_samples[i]);
+		}
+		serial_write(FEND);
+	#endif
+}
+
+void kiss_indicate_autochan() {
+	serial_write(FEND);
+	serial_write(CMD_AUTOCHAN);
+	#if MCU_VARIANT == MCU_ESP32 || MCU_VARIANT == MCU_NRF52
+		escaped_serial_write(autochan_mode);
+		escaped_serial_write(autochan_interval_min);
+		for (uint8_t i = 0; i < autochan_count; i++) {
+			escaped_serial_write(autochan_freqs[i]>>24);
+			escaped_serial_write(autochan_freqs[i]>>16);
+			escaped_serial_write(autochan_freqs[i]>>8);
+			escaped_serial_write(autochan_freqs[i]);
+		}
+	#else
+		serial_write(0x00);
+		serial_write(0x00);
+	#endif
+	serial_write(FEND);
+}
+
+void kiss_indicate_rx_filter() {
+	serial_write(FEND);
+	serial_write(CMD_RX_FILTER);
+	#if MCU_VARIANT == MCU_ESP32 || MCU_VARIANT == MCU_NRF52
+		// Settings and prefixes, followed by the
+		// number of packets dropped by the filter
+		escaped_serial_write(rx_filter_offset);
+		escaped_serial_write(rx_filter_len);
+		for (uint8_t i = 0; i < rx_filter_count; i++) {
+			for (uint8_t k = 0; k < rx_filter_len; k++) escaped_serial_write(rx_filter[i][k]);
+		}
+		escaped_serial_write(rx_filtered>>24);
+		escaped_serial_write(rx_filtered>>16);
+		escaped_serial_write(rx_filtered>>8);
+		escaped_serial_write(rx_filtered);
+	#else
+		serial_write(0x00);
+		serial_write(0x00);
+	#endif
+	serial_write(FEND);
+}
+
+void kiss_indicate_profile(bool list) {
+	serial_write(FEND);
+	serial_write(CMD_PROFILE);
+	#if MCU_VARIANT == MCU_ESP32 || MCU_VARIANT == MCU_NRF52
+		escaped_serial_write(profile_active);
+		for (uint8_t i = 0; list && i < PROFILE_SLOTS; i++) {
+			radio_profile_t *p = &profiles[i];
+			if (!p->used) continue;
+			escaped_serial_write(i);
+			escaped_serial_write(p->freq>>24);
+			escaped_serial_write(p->freq>>16);
+			escaped_serial_write(p->freq>>8);
+			escaped_serial_write(p->freq);
+			escaped_serial_write(p->bw>>24);
+			escaped_serial_write(p->bw>>16);
+			escaped_serial_write(p->bw>>8);
+			escaped_serial_write(p->bw);
+			escaped_serial_write(p->sf);
+			escaped_serial_write(p->cr);
+			escaped_serial_write(p->txp);
+			escaped_serial_write(p->sync_word);
+		}
+	#else
+		serial_write(0xFF);
+	#endif
+	serial_write(FEND);
+}
+
+void kiss_indicate_hop() {
+	serial_write(FEND);
+	serial_write(CMD_HOP);
+	#if MCU_VARIANT == MCU_ESP32 || MCU_VARIANT == MCU_NRF52
+		// Dwell time and seed, then frequency and
+		// TX airtime in ms for every channel
+		escaped_serial_write(hop_dwell_ms>>8);
+		escaped_serial_write(hop_dwell_ms);
+		escaped_serial_write(hop_seed>>8);
+		escaped_serial_write(hop_seed);
+		for (uint8_t i = 0; i < hop_count; i++) {
+			escaped_serial_write(hop_freqs[i]>>24);
+			escaped_serial_write(hop_freqs[i]>>16);
+			escaped_serial_write(hop_freqs[i]>>8);
+			escaped_serial_write(hop_freqs[i]);
+			escaped_serial_write(hop_airtime_ms[i]>>24);
+			escaped_serial_write(hop_airtime_ms[i]>>16);
+			escaped_serial_write(hop_airtime_ms[i]>>8);
+			escaped_serial_write(hop_airtime_ms[i]);
+		}
+	#else
+		serial_write(0x00);
+		serial_write(0x00);
+		serial_write(0x00);
+		serial_write(0x00);
+	#endif
+	serial_write(FEND);
+}
+
+void kiss_indicate_stat_chan() {
+	#if MCU_VARIANT == MCU_ESP32 || MCU_VARIANT == MCU_NRF52
+		// Index of the best channel, then the
+		// frequency and score of every channel
+		serial_write(FEND);
+		serial_write(CMD_STAT_CHAN);
+		escaped_serial_write(autochan_best);
+		for (uint8_t i = 0; i < autochan_count; i++) {
+			escaped_serial_write(autochan_freqs[i]>>24);
+			escaped_serial_write(autochan_freqs[i]>>16);
+			escaped_serial_write(autochan_freqs[i]>>8);
+			escaped_serial_write(autochan_freqs[i]);
+			escaped_serial_write(autochan_score[i]);
+		}
+		serial_write(FEND);
+	#endif
+}
+
 void kiss_indicate_detect() {
 	serial_write(FEND);
 	serial_write(CMD_DETECT);
@@ -1009,31 +1303,109 @@ inline uint8_t packetSequence(uint8_t header) {
 	return header >> 4;
 }
 
+void update_csma_slot() {
+	// The slot is fixed unless the host sets it
+	// to zero, in which case it spans a number of
+	// symbols plus the measured time it takes to
+	// run channel activity detection
+	if (csma_slot_fixed_ms != 0) {
+		csma_slot_ms = csma_slot_fixed_ms;
+	} else if (lora_symbol_time_ns > 0) {
+		uint32_t slot_us = (lora_symbol_time_ns/1000)*CSMA_SLOT_SYMBOLS + csma_cad_us;
+		uint32_t slot_ms = (slot_us+999)/1000;
+		if (slot_ms < CSMA_SLOT_MIN_MS) slot_ms = CSMA_SLOT_MIN_MS;
+		if (slot_ms > CSMA_SLOT_MAX_MS) slot_ms = CSMA_SLOT_MAX_MS;
+		csma_slot_ms = (int)slot_ms;
+	}
+}
+
 void setPreamble() {
 	if (radio_online) LoRa->setPreambleLength(lora_preamble_symbols);
 	kiss_indicate_phy_stats();
 }
 
-void updateBitrate() {
-	#if MCU_VARIANT == MCU_ESP32 || MCU_VARIANT == MCU_NRF52
-		if (radio_online) {
-			lora_symbol_rate = (float)lora_bw/(float)(pow(2, lora_sf));
-			lora_symbol_time_ms = (1.0/lora_symbol_rate)*1000.0;
-			lora_bitrate = (uint32_t)(lora_sf * ( (4.0/(float)lora_cr) / ((float)(pow(2, lora_sf))/((float)lora_bw/1000.0)) ) * 1000.0);
-			lora_us_per_byte = 1000000.0/((float)lora_bitrate/8.0);
-			// csma_slot_ms = lora_symbol_time_ms*10;
-			float target_preamble_symbols = (LORA_PREAMBLE_TARGET_MS/lora_symbol_time_ms)-LORA_PREAMBLE_SYMBOLS_HW;
-			if (target_preamble_symbols < LORA_PREAMBLE_SYMBOLS_MIN) {
-				target_preamble_symbols = LORA_PREAMBLE_SYMBOLS_MIN;
-			} else {
-				target_preamble_symbols = ceil(target_preamble_symbols);
-			}
-			lora_preamble_symbols = (long)target_preamble_symbols;
-			setPreamble();
-		} else {
-			lora_bitrate = 0;
+#if MCU_VARIANT == MCU_ESP32 || MCU_VARIANT == MCU_NRF52
+long preambleSymbols(uint32_t symbol_time_ns) {
+	// To reach duty-cycled receivers, the preamble
+	// has to span a full sleep and listen period,
+	// either that of this node or the one set for
+	// the receivers it sends to, if that is longer
+	uint32_t wake_ms = rx_duty ? (uint32_t)rx_duty_rx_ms+rx_duty_sleep_ms : 0;
+	if (tx_wake_ms > wake_ms) wake_ms = tx_wake_ms;
+	uint64_t target_preamble_ns = ((uint64_t)LORA_PREAMBLE_TARGET_MS+wake_ms)*1000000;
+	uint64_t target_preamble_symbols = (target_preamble_ns+symbol_time_ns-1)/symbol_time_ns;
+	if (target_preamble_symbols < LORA_PREAMBLE_SYMBOLS_MIN+LORA_PREAMBLE_SYMBOLS_HW) {
+		target_preamble_symbols = LORA_PREAMBLE_SYMBOLS_MIN;
+	} else {
+		target_preamble_symbols -= LORA_PREAMBLE_SYMBOLS_HW;
+	}
+	if (target_preamble_symbols > 0xFFFF) target_preamble_symbols = 0xFFFF;
+	return (long)target_preamble_symbols;
+}
+#endif
+
+// Recomputes the PHY model from the current
+// parameters, and returns true if the LoRa
+// preamble length was sized again
+bool updatePhyModel() {
+	bool preamble_sized = false;
+	#if MODEM == SX1280 || MODEM == SX1262
+		if (radio_online && lora_bw != 0 && lora_modulation != MODULATION_LORA && LoRa->getBitrate() != 0) {
+			// GFSK and FLRC take the bitrate from the
+			// modem, and one byte counts as a symbol
+			lora_bitrate = LoRa->getBitrate();
+			lora_byte_time_ns = (uint32_t)(8000000000ULL / lora_bitrate);
+			lora_symbol_time_ns = lora_byte_time_ns;
+			lora_overhead_us = phy_overhead_fsk_us(lora_byte_time_ns);
+			#if MCU_VARIANT == MCU_ESP32 || MCU_VARIANT == MCU_NRF52
+				update_csma_slot();
+			#endif
+			return false;
 		}
 	#endif
+
+	if (radio_online && lora_bw != 0 && lora_sf != 0) {
+		lora_symbol_time_ns = phy_symbol_time_ns(lora_sf, lora_bw);
+		lora_byte_time_ns = phy_byte_time_ns(lora_sf, lora_cr, lora_bw);
+		lora_bitrate = phy_bitrate(lora_sf, lora_cr, lora_bw);
+
+		#if MCU_VARIANT == MCU_ESP32 || MCU_VARIANT == MCU_NRF52
+			update_csma_slot();
+			lora_preamble_symbols = preambleSymbols(lora_symbol_time_ns);
+			preamble_sized = true;
+		#endif
+
+		lora_overhead_us = phy_overhead_us(lora_preamble_symbols, lora_symbol_time_ns);
+	} else {
+		lora_bitrate = 0;
+	}
+
+	return preamble_sized;
+}
+
+void updateBitrate() {
+	if (updatePhyModel()) setPreamble();
+}
+
+int clampSpreadingFactor(int sf) {
+	if (sf < 5) sf = 5;
+	if (sf > 12) sf = 12;
+	return sf;
+}
+
+int clampCodingRate(int cr) {
+	if (cr < 5) cr = 5;
+	if (cr > 8) cr = 8;
+	return cr;
+}
+
+int clampTXPower(int txp) {
+	#if MODEM == SX1262
+		if (txp > 22) txp = 22;
+	#else
+		if (txp > 17) txp = 17;
+	#endif
+	return txp;
 }
 
 void setSpreadingFactor() {
@@ -1046,6 +1418,48 @@ void setCodingRate() {
 	updateBitrate();
 }
 
+void getModulation() {
+	#if MODEM == SX1280 || MODEM == SX1262
+		if (radio_online) {
+			lora_modulation = LoRa->getModulation();
+			lora_frame_mtu = (lora_modulation == MODULATION_LORA) ? SINGLE_MTU : LoRa->maxPacketLength();
+		}
+
+		// A sleeping receiver can't catch the short
+		// GFSK or FLRC preamble, and putting the
+		// modem to sleep would lose its configuration,
+		// so duty-cycled receive is turned off
+		if (lora_modulation != MODULATION_LORA) {
+			rx_duty = false;
+			rx_duty_hw = false;
+			rx_duty_rx_ms = 0;
+			rx_duty_sleep_ms = 0;
+		}
+	#else
+		lora_modulation = MODULATION_LORA;
+	#endif
+}
+
+void setModulation() {
+	#if MODEM == SX1280 || MODEM == SX1262
+		if (radio_online) LoRa->setModulation(lora_modulation);
+	#endif
+	getModulation();
+	updateBitrate();
+}
+
+void setSyncWord() {
+	if (radio_online) {
+		#if MODEM == SX1262
+			// The SX1262 spreads the sync word over
+			// two bytes, so 0x12 becomes 0x1424
+			LoRa->setSyncWord((uint16_t)(lora_sync_word & 0xF0) << 8 | (lora_sync_word & 0x0F) << 4 | 0x0404);
+		#else
+			LoRa->setSyncWord(lora_sync_word);
+		#endif
+	}
+}
+
 void set_implicit_length(uint8_t len) {
 	implicit_l = len;
 	if (implicit_l != 0) {
@@ -1060,35 +1474,43 @@ int getTxPower() {
 	return (int)txp;
 }
 
+int getTxPowerPin() {
+	if (model == MODEL_11) return PA_OUTPUT_RFO_PIN;
+	if (model == MODEL_12) return PA_OUTPUT_RFO_PIN;
+
+	if (model == MODEL_A1) return PA_OUTPUT_PA_BOOST_PIN;
+	if (model == MODEL_A2) return PA_OUTPUT_PA_BOOST_PIN;
+	if (model == MODEL_A3) return PA_OUTPUT_RFO_PIN;
+	if (model == MODEL_A4) return PA_OUTPUT_RFO_PIN;
+	if (model == MODEL_A6) return PA_OUTPUT_PA_BOOST_PIN;
+	if (model == MODEL_A7) return PA_OUTPUT_PA_BOOST_PIN;
+	if (model == MODEL_A8) return PA_OUTPUT_PA_BOOST_PIN;
+	if (model == MODEL_A9) return PA_OUTPUT_PA_BOOST_PIN;
+
+	if (model == MODEL_B3) return PA_OUTPUT_PA_BOOST_PIN;
+	if (model == MODEL_B4) return PA_OUTPUT_PA_BOOST_PIN;
+	if (model == MODEL_B8) return PA_OUTPUT_PA_BOOST_PIN;
+	if (model == MODEL_B9) return PA_OUTPUT_PA_BOOST_PIN;
+
+	if (model == MODEL_C4) return PA_OUTPUT_PA_BOOST_PIN;
+	if (model == MODEL_C9) return PA_OUTPUT_PA_BOOST_PIN;
+
+	if (model == MODEL_E4) return PA_OUTPUT_PA_BOOST_PIN;
+	if (model == MODEL_E9) return PA_OUTPUT_PA_BOOST_PIN;
+	if (model == MODEL_E3) return PA_OUTPUT_PA_BOOST_PIN;
+	if (model == MODEL_E8) return PA_OUTPUT_PA_BOOST_PIN;
+
+	if (model == MODEL_FE) return PA_OUTPUT_PA_BOOST_PIN;
+	if (model == MODEL_FF) return PA_OUTPUT_RFO_PIN;
+
+	// Unknown models keep the modem default
+	return -1;
+}
+
 void setTXPower() {
 	if (radio_online) {
-		if (model == MODEL_11) LoRa->setTxPower(lora_txp, PA_OUTPUT_RFO_PIN);
-		if (model == MODEL_12) LoRa->setTxPower(lora_txp, PA_OUTPUT_RFO_PIN);
-
-		if (model == MODEL_A1) LoRa->setTxPower(lora_txp, PA_OUTPUT_PA_BOOST_PIN);
-		if (model == MODEL_A2) LoRa->setTxPower(lora_txp, PA_OUTPUT_PA_BOOST_PIN);
-		if (model == MODEL_A3) LoRa->setTxPower(lora_txp, PA_OUTPUT_RFO_PIN);
-		if (model == MODEL_A4) LoRa->setTxPower(lora_txp, PA_OUTPUT_RFO_PIN);
-		if (model == MODEL_A6) LoRa->setTxPower(lora_txp, PA_OUTPUT_PA_BOOST_PIN);
-		if (model == MODEL_A7) LoRa->setTxPower(lora_txp, PA_OUTPUT_PA_BOOST_PIN);
-		if (model == MODEL_A8) LoRa->setTxPower(lora_txp, PA_OUTPUT_PA_BOOST_PIN);
-		if (model == MODEL_A9) LoRa->setTxPower(lora_txp, PA_OUTPUT_PA_BOOST_PIN);
-
-		if (model == MODEL_B3) LoRa->setTxPower(lora_txp, PA_OUTPUT_PA_BOOST_PIN);
-		if (model == MODEL_B4) LoRa->setTxPower(lora_txp, PA_OUTPUT_PA_BOOST_PIN);
-		if (model == MODEL_B8) LoRa->setTxPower(lora_txp, PA_OUTPUT_PA_BOOST_PIN);
-		if (model == MODEL_B9) LoRa->setTxPower(lora_txp, PA_OUTPUT_PA_BOOST_PIN);
-
-		if (model == MODEL_C4) LoRa->setTxPower(lora_txp, PA_OUTPUT_PA_BOOST_PIN);
-		if (model == MODEL_C9) LoRa->setTxPower(lora_txp, PA_OUTPUT_PA_BOOST_PIN);
-
-		if (model == MODEL_E4) LoRa->setTxPower(lora_txp, PA_OUTPUT_PA_BOOST_PIN);
-		if (model == MODEL_E9) LoRa->setTxPower(lora_txp, PA_OUTPUT_PA_BOOST_PIN);
-		if (model == MODEL_E3) LoRa->setTxPower(lora_txp, PA_OUTPUT_PA_BOOST_PIN);
-		if (model == MODEL_E8) LoRa->setTxPower(lora_txp, PA_OUTPUT_PA_BOOST_PIN);
-
-		if (model == MODEL_FE) LoRa->setTxPower(lora_txp, PA_OUTPUT_PA_BOOST_PIN);
-		if (model == MODEL_FF) LoRa->setTxPower(lora_txp, PA_OUTPUT_RFO_PIN);
+		int pin = getTxPowerPin();
+		if (pin != -1) LoRa->setTxPower(lora_txp, pin);
 	}
 }
 
@@ -1120,6 +1542,44 @@ void setFrequency() {
 	}
 }
 
+void applyRadioConfig() {
+	// Writes the complete configuration in one
+	// pass, and reads back what the modem ended
+	// up with before updating the PHY model
+	if (radio_online) {
+		#if MCU_VARIANT == MCU_ESP32 || MCU_VARIANT == MCU_NRF52
+			// The preamble is sized up front, so that it
+			// goes out with the rest of the packet
+			// parameters instead of in a second write
+			if (lora_modulation == MODULATION_LORA && lora_bw != 0 && lora_sf != 0) {
+				lora_preamble_symbols = preambleSymbols(phy_symbol_time_ns(lora_sf, lora_bw));
+			}
+		#endif
+
+		RadioConfig config;
+		config.frequency = lora_freq;
+		config.bandwidth = lora_bw;
+		config.sf = lora_sf;
+		config.cr = lora_cr;
+		config.modulation = lora_modulation;
+		config.txp = lora_txp;
+		config.txp_pin = getTxPowerPin();
+		config.preamble = lora_preamble_symbols;
+		LoRa->applyConfig(&config);
+
+		getModulation();
+		lora_bw = LoRa->getSignalBandwidth();
+		lora_freq = LoRa->getFrequency();
+
+		// The bandwidth read back can differ slightly
+		// from the requested one, and only then is the
+		// preamble written again
+		if (updatePhyModel() && lora_preamble_symbols != config.preamble) {
+			LoRa->setPreambleLength(lora_preamble_symbols);
+		}
+	}
+}
+
 uint8_t getRandom() {
 	if (radio_online) {
 		return LoRa->random();
@@ -1230,13 +1690,35 @@ void eeprom_flush() {
 }
 #endif
 
+// Updates made between eeprom_batch_begin()
+// and eeprom_batch_commit() are committed to
+// flash once, instead of once per byte
+bool eeprom_batch_active = false;
+bool eeprom_batch_dirty = false;
+
+void eeprom_batch_begin() {
+	eeprom_batch_active = true;
+	eeprom_batch_dirty = false;
+}
+
+void eeprom_batch_commit() {
+	eeprom_batch_active = false;
+	#if MCU_VARIANT == MCU_ESP32
+		if (eeprom_batch_dirty) EEPROM.commit();
+	#elif !HAS_EEPROM && MCU_VARIANT == MCU_NRF52
+		eeprom_flush();
+	#endif
+	eeprom_batch_dirty = false;
+}
+
 void eeprom_update(int mapped_addr, uint8_t byte) {
 	#if MCU_VARIANT == MCU_1284P || MCU_VARIANT == MCU_2560
 		EEPROM.update(mapped_addr, byte);
 	#elif MCU_VARIANT == MCU_ESP32
 		if (EEPROM.read(mapped_addr) != byte) {
 			EEPROM.write(mapped_addr, byte);
-			EEPROM.commit();
+			if (eeprom_batch_active) { eeprom_batch_dirty = true; }
+			else { EEPROM.commit(); }
 		}
     #elif !HAS_EEPROM && MCU_VARIANT == MCU_NRF52
         // todo: clean up this implementation, writing one byte and syncing
@@ -1278,9 +1760,11 @@ void eeprom_write(uint8_t addr, uint8_t byte) {
 }
 
 void eeprom_erase() {
+	eeprom_batch_begin();
 	for (int addr = 0; addr < EEPROM_RESERVED; addr++) {
 		eeprom_update(eeprom_addr(addr), 0xFF);
 	}
+	eeprom_batch_commit();
 	hard_reset();
 }
 
@@ -1448,18 +1932,23 @@ void eeprom_conf_load() {
             lora_txp = EEPROM.read(eeprom_addr(ADDR_CONF_TXP));
             lora_freq = (uint32_t)EEPROM.read(eeprom_addr(ADDR_CONF_FREQ)+0x00) << 24 | (uint32_t)EEPROM.read(eeprom_addr(ADDR_CONF_FREQ)+0x01) << 16 | (uint32_t)EEPROM.read(eeprom_addr(ADDR_CONF_FREQ)+0x02) << 8 | (uint32_t)EEPROM.read(eeprom_addr(ADDR_CONF_FREQ)+0x03);
             lora_bw = (uint32_t)EEPROM.read(eeprom_addr(ADDR_CONF_BW)+0x00) << 24 | (uint32_t)EEPROM.read(eeprom_addr(ADDR_CONF_BW)+0x01) << 16 | (uint32_t)EEPROM.read(eeprom_addr(ADDR_CONF_BW)+0x02) << 8 | (uint32_t)EEPROM.read(eeprom_addr(ADDR_CONF_BW)+0x03);
+            uint8_t sw = EEPROM.read(eeprom_addr(ADDR_CONF_SYNC));
         #elif MCU_VARIANT == MCU_NRF52
             lora_sf = eeprom_read(eeprom_addr(ADDR_CONF_SF));
             lora_cr = eeprom_read(eeprom_addr(ADDR_CONF_CR));
             lora_txp = eeprom_read(eeprom_addr(ADDR_CONF_TXP));
             lora_freq = (uint32_t)eeprom_read(eeprom_addr(ADDR_CONF_FREQ)+0x00) << 24 | (uint32_t)eeprom_read(eeprom_addr(ADDR_CONF_FREQ)+0x01) << 16 | (uint32_t)eeprom_read(eeprom_addr(ADDR_CONF_FREQ)+0x02) << 8 | (uint32_t)eeprom_read(eeprom_addr(ADDR_CONF_FREQ)+0x03);
             lora_bw = (uint32_t)eeprom_read(eeprom_addr(ADDR_CONF_BW)+0x00) << 24 | (uint32_t)eeprom_read(eeprom_addr(ADDR_CONF_BW)+0x01) << 16 | (uint32_t)eeprom_read(eeprom_addr(ADDR_CONF_BW)+0x02) << 8 | (uint32_t)eeprom_read(eeprom_addr(ADDR_CONF_BW)+0x03);
+            uint8_t sw = eeprom_read(eeprom_addr(ADDR_CONF_SYNC));
         #endif
+        // An erased byte selects the default
+        lora_sync_word = (sw == 0xFF) ? SYNC_WORD_DEFAULT : sw;
 	}
 }
 
 void eeprom_conf_save() {
 	if (hw_ready && radio_online) {
+		eeprom_batch_begin();
 		eeprom_update(eeprom_addr(ADDR_CONF_SF), lora_sf);
 		eeprom_update(eeprom_addr(ADDR_CONF_CR), lora_cr);
 		eeprom_update(eeprom_addr(ADDR_CONF_TXP), lora_txp);
@@ -1474,7 +1963,10 @@ void eeprom_conf_save() {
 		eeprom_update(eeprom_addr(ADDR_CONF_FREQ)+0x02, lora_freq>>8);
 		eeprom_update(eeprom_addr(ADDR_CONF_FREQ)+0x03, lora_freq);
 
+		eeprom_update(eeprom_addr(ADDR_CONF_SYNC), lora_sync_word);
+
 		eeprom_update(eeprom_addr(ADDR_CONF_OK), CONF_OK_BYTE);
+		eeprom_batch_commit();
 		led_indicate_info(10);
 	} else {
 		led_indicate_warning(10);
@@ -1482,7 +1974,10 @@ void eeprom_conf_save() {
 }
 
 void eeprom_conf_delete() {
+	eeprom_batch_begin();
+	eeprom_update(eeprom_addr(ADDR_CONF_SYNC), 0xFF);
 	eeprom_update(eeprom_addr(ADDR_CONF_OK), 0x00);
+	eeprom_batch_commit();
 }
 
 void unlock_rom() {
@@ -1491,12 +1986,13 @@ void unlock_rom() {
 }
 
 void init_channel_stats() {
-	#if MCU_VARIANT == MCU_ESP32
+	#if MCU_VARIANT == MCU_ESP32 || MCU_VARIANT == MCU_NRF52
 		for (uint16_t ai = 0; ai < DCD_SAMPLES; ai++) { util_samples[ai] = false; }
 		for (uint16_t ai = 0; ai < AIRTIME_BINS; ai++) { airtime_bins[ai] = 0; }
 		for (uint16_t ai = 0; ai < AIRTIME_BINS; ai++) { longterm_bins[ai] = 0.0; }
 		local_channel_util = 0.0;
 		total_channel_util = 0.0;
+		longterm_channel_util = 0.0;
 		airtime = 0.0;
 		longterm_airtime = 0.0;
 	#endif
@@ -44,10 +44,12 @@
 #define OP_DIO3_TCXO_CTRL_6X        0x97
 #define OP_DIO2_RF_CTRL_6X          0x9D
 #define OP_CAD_PARAMS               0x88
+#define OP_CAD_6X                   0xC5
 #define OP_CALIBRATE_6X             0x89
 #define OP_RX_TX_FALLBACK_MODE_6X   0x93
 #define OP_REGULATOR_MODE_6X        0x96
 #define OP_CALIBRATE_IMAGE_6X       0x98
+#define OP_RX_DUTY_CYCLE_6X         0x94
 
 #define MASK_CALIBRATE_ALL          0x7f
 
@@ -56,9 +58,12 @@
 #define IRQ_HEADER_DET_MASK_6X      0x10
 #define IRQ_PREAMBLE_DET_MASK_6X    0x04
 #define IRQ_PAYLOAD_CRC_ERROR_MASK_6X 0x40
+#define IRQ_CAD_DONE_MASK_6X        0x80
+#define IRQ_CAD_DETECTED_MASK_6X    0x01 // in the upper irq status byte
 #define IRQ_ALL_MASK_6X             0b0100001111111111
 
 #define MODE_LONG_RANGE_MODE_6X     0x01
+#define MODE_GFSK_6X                0x00
 
 #define OP_FIFO_WRITE_6X            0x0E
 #define OP_FIFO_READ_6X             0x1E
@@ -68,6 +73,23 @@
 #define REG_SYNC_WORD_LSB_6X      0x0741
 #define REG_PAYLOAD_LENGTH_6X     0x0702 // https://github.com/beegee-tokyo/SX126x-Arduino/blob/master/src/radio/sx126x/sx126x.h#L98
 #define REG_RANDOM_GEN_6X         0x0819
+#define REG_FREQ_ERROR_6X         0x076B
+#define REG_WHITENING_INIT_6X     0x06B8
+#define REG_CRC_INIT_6X           0x06BC
+#define REG_CRC_POLY_6X           0x06BE
+#define REG_FSK_SYNC_WORD_6X      0x06C0
+
+#define IRQ_SYNC_VALID_MASK_6X      0x08
+#define GFSK_PULSE_BT_0_5_6X        0x09
+#define GFSK_PREAMBLE_BITS_6X       32
+#define GFSK_PREAMBLE_DETECT_16_6X  0x05
+#define GFSK_SYNC_WORD_BITS_6X      32
+#define GFSK_VARIABLE_LENGTH_6X     0x01
+#define GFSK_CRC_OFF_6X             0x01
+#define GFSK_CRC_2_BYTES_INV_6X     0x06
+#define GFSK_WHITENING_ON_6X        0x01
+#define FSK_ED_THRESHOLD            -95
+#define FSK_ED_SAMPLE_US            50
 
 #define MODE_TCXO_3_3V_6X           0x07
 #define MODE_TCXO_3_0V_6X           0x06
@@ -108,6 +130,10 @@ sx126x::sx126x() :
   _bw(0x04),
   _cr(0x01),
   _ldro(0x00),
+  _modulation(MODULATION_LORA),
+  _syncWord(SYNC_WORD_6X),
+  _imageCal({0}),
+  _imageCalValid(false),
   _packetIndex(0),
   _preambleLength(18),
   _implicitHeaderMode(0),
@@ -117,6 +143,11 @@ sx126x::sx126x() :
   _fifo_rx_addr_ptr(0),
   _packet({0}),
   _preinit_done(false),
+  _rxTimestamp(0),
+  _txTimestamp(0),
+  _txActive(false),
+  _rxDutyCycle(false),
+  _onIrq(NULL),
   _onReceive(NULL)
 {
   // overide Stream timeout value
@@ -196,8 +227,49 @@ void sx126x::rxAntEnable()
 
 void sx126x::loraMode() {
     // enable lora mode on the SX1262 chip
+    _modulation = MODULATION_LORA;
+    setPacketType();
+}
+
+void sx126x::setPacketType() {
     uint8_t mode = MODE_LONG_RANGE_MODE_6X;
+    if (_modulation == MODULATION_GFSK) mode = MODE_GFSK_6X;
     executeOpcode(OP_PACKET_TYPE_6X, &mode, 1);
+
+    if (_modulation == MODULATION_GFSK) {
+        // sync word ending in the LoRa sync word,
+        // CCITT CRC and the default whitening seed
+        writeRegister(REG_FSK_SYNC_WORD_6X+0, 0x52);
+        writeRegister(REG_FSK_SYNC_WORD_6X+1, 0x4E);
+        writeRegister(REG_FSK_SYNC_WORD_6X+2, (_syncWord & 0xFF00) >> 8);
+        writeRegister(REG_FSK_SYNC_WORD_6X+3, _syncWord & 0x00FF);
+        writeRegister(REG_CRC_INIT_6X, 0x1D);
+        writeRegister(REG_CRC_INIT_6X+1, 0x0F);
+        writeRegister(REG_CRC_POLY_6X, 0x10);
+        writeRegister(REG_CRC_POLY_6X+1, 0x21);
+        writeRegister(REG_WHITENING_INIT_6X, (readRegister(REG_WHITENING_INIT_6X) & 0xFE) | 0x01);
+        writeRegister(REG_WHITENING_INIT_6X+1, 0xFF);
+    }
+}
+
+// GFSK bitrate, deviation and RX bandwidth
+// for each LoRa bandwidth, keeping the GFSK
+// signal within the same channel width
+struct gfsk_params_t { uint8_t bw; uint32_t bitrate; uint32_t fdev; uint8_t rxbw; };
+static const gfsk_params_t gfsk_params[] = {
+    { 0x06, 300000, 75000, 0x09 },
+    { 0x05, 150000, 37500, 0x0A },
+    { 0x04,  75000, 18750, 0x0B },
+    { 0x03,  38400,  9600, 0x0C },
+    { 0x02,  19200,  4800, 0x0D },
+};
+
+static const gfsk_params_t *gfsk_lookup(uint8_t bw) {
+    for (uint8_t i = 0; i < sizeof(gfsk_params)/sizeof(gfsk_params[0]); i++) {
+        if (gfsk_params[i].bw == bw) return &gfsk_params[i];
+    }
+    static const gfsk_params_t gfsk_narrow = { 0x00, 9600, 2400, 0x0E };
+    return &gfsk_narrow;
 }
 
 void sx126x::waitOnBusy() {
@@ -299,6 +371,22 @@ void sx126x::setModulationParams(uint8_t sf, uint8_t bw, uint8_t cr, int ldro) {
   // to set all these parameters at once or not at all.
   uint8_t buf[8];
 
+  if (_modulation == MODULATION_GFSK) {
+      const gfsk_params_t *p = gfsk_lookup(bw);
+      uint32_t br = 1024000000UL / p->bitrate;
+      uint32_t fdev = (uint32_t)(((uint64_t)p->fdev << 25) / 32000000UL);
+      buf[0] = (br >> 16) & 0xFF;
+      buf[1] = (br >> 8) & 0xFF;
+      buf[2] = br & 0xFF;
+      buf[3] = GFSK_PULSE_BT_0_5_6X;
+      buf[4] = p->rxbw;
+      buf[5] = (fdev >> 16) & 0xFF;
+      buf[6] = (fdev >> 8) & 0xFF;
+      buf[7] = fdev & 0xFF;
+      executeOpcode(OP_MODULATION_PARAMS_6X, buf, 8);
+      return;
+  }
+
   buf[0] = sf;
   buf[1] = bw;
   buf[2] = cr; 
@@ -318,6 +406,21 @@ void sx126x::setPacketParams(long preamble, uint8_t headermode, uint8_t length,
   // to set all these parameters at once or not at all.
   uint8_t buf[9];
 
+  if (_modulation == MODULATION_GFSK) {
+      // the GFSK preamble is counted in bits
+      buf[0] = 0x00;
+      buf[1] = GFSK_PREAMBLE_BITS_6X;
+      buf[2] = GFSK_PREAMBLE_DETECT_16_6X;
+      buf[3] = GFSK_SYNC_WORD_BITS_6X;
+      buf[4] = 0x00; // no address filtering
+      buf[5] = headermode ? 0x00 : GFSK_VARIABLE_LENGTH_6X;
+      buf[6] = length;
+      buf[7] = crc ? GFSK_CRC_2_BYTES_INV_6X : GFSK_CRC_OFF_6X;
+      buf[8] = GFSK_WHITENING_ON_6X;
+      executeOpcode(OP_PACKET_PARAMS_6X, buf, 9);
+      return;
+  }
+
   buf[0] = uint8_t((preamble & 0xFF00) >> 8);
   buf[1] = uint8_t((preamble & 0x00FF));
   buf[2] = headermode;
@@ -382,8 +485,17 @@ void sx126x::calibrate_image(long frequency) {
     image_freq[1] = 0xE9;
   }
 
+  // The calibration holds for the whole band,
+  // so it only has to run again when the band
+  // changes
+  if (_imageCalValid && image_freq[0] == _imageCal[0] && image_freq[1] == _imageCal[1]) return;
+
   executeOpcode(OP_CALIBRATE_IMAGE_6X, image_freq, 2);
   waitOnBusy();
+
+  _imageCal[0] = image_freq[0];
+  _imageCal[1] = image_freq[1];
+  _imageCalValid = true;
 }
 
 int sx126x::begin(long frequency)
@@ -405,11 +517,12 @@ int sx126x::begin(long frequency)
   }
 
   calibrate();
+  _imageCalValid = false;
   calibrate_image(frequency);
 
   enableTCXO();
 
-  loraMode();
+  setPacketType();
   standby();
 
   // Set sync word
@@ -475,6 +588,8 @@ int sx126x::endPacket()
       setPacketParams(_preambleLength, _implicitHeaderMode, _payloadLength, _crcMode);
 
       // put in single TX mode
+      _txTimestamp = 0;
+      _txActive = true;
       uint8_t timeout[3] = {0};
       executeOpcode(OP_TX_6X, timeout, 3);
 
@@ -493,6 +608,11 @@ int sx126x::endPacket()
         yield();
       }
 
+      // fall back to the polled time if the
+      // TX_DONE interrupt was not captured
+      _txActive = false;
+      if (_txTimestamp == 0) _txTimestamp = micros();
+
       // clear IRQ's
 
       uint8_t mask[2];
@@ -516,7 +636,12 @@ uint8_t sx126x::modemStatus() {
       clearbuf[1] = IRQ_PREAMBLE_DET_MASK_6X;
     }
 
-    if ((buf[1] & IRQ_HEADER_DET_MASK_6X) != 0) {
+    // GFSK has no header, so a valid sync
+    // word is used as the indicator instead
+    uint8_t header_mask = IRQ_HEADER_DET_MASK_6X;
+    if (_modulation == MODULATION_GFSK) header_mask = IRQ_SYNC_VALID_MASK_6X;
+
+    if ((buf[1] & header_mask) != 0) {
       byte = byte | 0x02 | 0x04;
     }
 
@@ -542,6 +667,7 @@ int ISR_VECT sx126x::currentRssi() {
 uint8_t sx126x::packetRssiRaw() {
     uint8_t buf[3] = {0};
     executeOpcodeRead(OP_PACKET_STATUS_6X, buf, 3);
+    if (_modulation == MODULATION_GFSK) return buf[1];
     return buf[2];
 }
 
@@ -549,17 +675,23 @@ int ISR_VECT sx126x::packetRssi() {
     // may need more calculations here
     uint8_t buf[3] = {0};
     executeOpcodeRead(OP_PACKET_STATUS_6X, buf, 3);
+    // GFSK reports the RSSI at sync in the
+    // second byte of the packet status
+    if (_modulation == MODULATION_GFSK) buf[0] = buf[1];
     int pkt_rssi = -buf[0] / 2;
     return pkt_rssi;
 }
 
 uint8_t ISR_VECT sx126x::packetSnrRaw() {
+    // there is no SNR estimate in GFSK mode
+    if (_modulation == MODULATION_GFSK) return 0;
     uint8_t buf[3] = {0};
     executeOpcodeRead(OP_PACKET_STATUS_6X, buf, 3);
     return buf[1];
 }
 
 float ISR_VECT sx126x::packetSnr() {
+    if (_modulation == MODULATION_GFSK) return 0.0;
     uint8_t buf[3] = {0};
     executeOpcodeRead(OP_PACKET_STATUS_6X, buf, 3);
     return float(buf[1]) * 0.25;
@@ -567,8 +699,22 @@ float ISR_VECT sx126x::packetSnr() {
 
 long sx126x::packetFrequencyError()
 {
-    // todo: implement this, no idea how to check it on the sx1262
-    const float fError = 0.0;
+    // The frequency error estimate is a 20-bit
+    // signed value spread over three registers
+    if (_modulation == MODULATION_GFSK) return 0;
+    int32_t freqError = 0;
+    freqError = static_cast<int32_t>(readRegister(REG_FREQ_ERROR_6X) & 0x0F);
+    freqError <<= 8L;
+    freqError += static_cast<int32_t>(readRegister(REG_FREQ_ERROR_6X+1));
+    freqError <<= 8L;
+    freqError += static_cast<int32_t>(readRegister(REG_FREQ_ERROR_6X+2));
+
+    if (freqError & 0x80000) { // Sign bit is on
+        freqError -= 1048576;
+    }
+
+    const float fError = 1.55f * static_cast<float>(freqError) / (1600.0f / (getSignalBandwidth() / 1000.0f));
+
     return static_cast<long>(fError);
 }
 
@@ -657,7 +803,7 @@ void sx126x::onReceive(void(*callback)(int))
 
     // set dio0 masks
     buf[2] = 0x00;
-    buf[3] = IRQ_RX_DONE_MASK_6X; 
+    buf[3] = IRQ_RX_DONE_MASK_6X | IRQ_TX_DONE_MASK_6X;
 
     // set dio1 masks
     buf[4] = 0x00; 
@@ -671,17 +817,36 @@ void sx126x::onReceive(void(*callback)(int))
 #ifdef SPI_HAS_NOTUSINGINTERRUPT
     SPI.usingInterrupt(digitalPinToInterrupt(_dio0));
 #endif
-    attachInterrupt(digitalPinToInterrupt(_dio0), sx126x::onDio0Rise, RISING);
+    // A modem beyond the available interrupt
+    // slots is left without an interrupt
+    int8_t instance = attachInstance();
+    if (instance >= 0) attachInterrupt(digitalPinToInterrupt(_dio0), _dio0Handlers[instance], RISING);
   } else {
     detachInterrupt(digitalPinToInterrupt(_dio0));
+    detachInstance();
 #ifdef SPI_HAS_NOTUSINGINTERRUPT
     SPI.notUsingInterrupt(digitalPinToInterrupt(_dio0));
 #endif
   }
 }
 
+void sx126x::onIrq(void(*callback)())
+{
+  // With an IRQ callback set, the ISR only
+  // timestamps and signals, and the caller
+  // must run handleIrq() outside the ISR
+  _onIrq = callback;
+}
+
+void sx126x::handleIrq()
+{
+  handleDio0Rise();
+}
+
 void sx126x::receive(int size)
 {
+    _rxDutyCycle = false;
+
     if (size > 0) {
         implicitHeaderMode();
 
@@ -700,6 +865,106 @@ void sx126x::receive(int size)
     executeOpcode(OP_RX_6X, mode, 3);
 }
 
+bool sx126x::receiveDutyCycle(uint32_t rx_us, uint32_t sleep_us, int size)
+{
+    // the 32 bit GFSK preamble is far too short
+    // for a sleeping receiver to catch, so the
+    // firmware keeps GFSK in continuous receive
+    if (_modulation == MODULATION_GFSK) return false;
+
+    if (size > 0) {
+        implicitHeaderMode();
+
+        // tell radio payload length
+        _payloadLength = size;
+        setPacketParams(_preambleLength, _implicitHeaderMode, _payloadLength, _crcMode);
+    } else {
+        explicitHeaderMode();
+    }
+
+    standby();
+
+    if (_rxen != -1) {
+        rxAntEnable();
+    }
+
+    // periods are set in steps of 15.625 us
+    uint32_t rx_period = (rx_us * 8) / 125;
+    uint32_t sleep_period = (sleep_us * 8) / 125;
+    if (rx_period > 0xFFFFFF) rx_period = 0xFFFFFF;
+    if (sleep_period > 0xFFFFFF) sleep_period = 0xFFFFFF;
+
+    _rxDutyParams[0] = (rx_period >> 16) & 0xFF;
+    _rxDutyParams[1] = (rx_period >> 8) & 0xFF;
+    _rxDutyParams[2] = rx_period & 0xFF;
+    _rxDutyParams[3] = (sleep_period >> 16) & 0xFF;
+    _rxDutyParams[4] = (sleep_period >> 8) & 0xFF;
+    _rxDutyParams[5] = sleep_period & 0xFF;
+
+    _rxDutyCycle = true;
+    executeOpcode(OP_RX_DUTY_CYCLE_6X, _rxDutyParams, 6);
+    return true;
+}
+
+bool sx126x::channelActivityDetect(int symbols)
+{
+    if (_modulation == MODULATION_GFSK) {
+        // There is no CAD in GFSK mode, so the
+        // channel is sampled for energy instead
+        if (_rxen != -1) {
+            rxAntEnable();
+        }
+        uint8_t mode[3] = {0x00, 0x00, 0x00};
+        executeOpcode(OP_RX_6X, mode, 3);
+        bool detected = false;
+        for (int i = 0; i < symbols && !detected; i++) {
+            delayMicroseconds(FSK_ED_SAMPLE_US);
+            if (currentRssi() > FSK_ED_THRESHOLD) detected = true;
+        }
+        return detected;
+    }
+
+    standby();
+
+    if (_rxen != -1) {
+        rxAntEnable();
+    }
+
+    // CAD length can be 1, 2, 4, 8 or 16 symbols
+    uint8_t cad_symbols = 0x00;
+    while (cad_symbols < 0x04 && (1 << cad_symbols) < symbols) { cad_symbols++; }
+
+    uint8_t buf[7];
+    buf[0] = cad_symbols;
+    buf[1] = _sf + 13; // detection peak
+    buf[2] = 10;       // detection minimum
+    buf[3] = 0x00;     // return to standby when done
+    buf[4] = 0x00;
+    buf[5] = 0x00;
+    buf[6] = 0x00;
+    executeOpcode(OP_CAD_PARAMS, buf, 7);
+    executeOpcode(OP_CAD_6X, buf, 0);
+
+    // wait for CAD done, with a timeout of a few
+    // symbols beyond the detection window
+    uint32_t timeout_ms = ((uint32_t)(1 << _sf) * ((1 << cad_symbols) + 2) * 1000) / getSignalBandwidth() + 2;
+    uint32_t started = millis();
+
+    uint8_t irq[2] = {0};
+    executeOpcodeRead(OP_GET_IRQ_STATUS_6X, irq, 2);
+    while ((irq[1] & IRQ_CAD_DONE_MASK_6X) == 0 && millis() - started <= timeout_ms) {
+        yield();
+        executeOpcodeRead(OP_GET_IRQ_STATUS_6X, irq, 2);
+    }
+
+    uint8_t mask[2];
+    mask[0] = IRQ_CAD_DETECTED_MASK_6X;
+    mask[1] = IRQ_CAD_DONE_MASK_6X;
+    executeOpcode(OP_CLEAR_IRQ_STATUS_6X, mask, 2);
+
+    return (irq[1] & IRQ_CAD_DONE_MASK_6X) && (irq[0] & IRQ_CAD_DETECTED_MASK_6X);
+}
+
 void sx126x::standby()
 {
   // STDBY_XOSC
@@ -731,6 +996,36 @@ void sx126x::enableTCXO() {
 // TODO: Once enabled, SX1262 needs a complete reset to disable TCXO
 void sx126x::disableTCXO() { }
 
+bool sx126x::setModulation(uint8_t modulation) {
+    if (modulation > MODULATION_GFSK) return false;
+
+    // Switching packet type resets the modem
+    // configuration, so all of it is re-applied
+    _modulation = modulation;
+    standby();
+    setPacketType();
+    if (_frequency != 0) setFrequency(_frequency);
+    setModulationParams(_sf, _bw, _cr, _ldro);
+    setPacketParams(_preambleLength, _implicitHeaderMode, _payloadLength, _crcMode);
+    setTxPower(_txp);
+    return true;
+}
+
+uint8_t sx126x::getModulation() {
+    return _modulation;
+}
+
+uint32_t sx126x::getBitrate() {
+    // Only known here in GFSK mode, the LoRa
+    // bitrate is derived by the caller
+    if (_modulation != MODULATION_GFSK) return 0;
+    return gfsk_lookup(_bw)->bitrate;
+}
+
+uint8_t sx126x::maxPacketLength() {
+    return MAX_PKT_LENGTH;
+}
+
 void sx126x::setTxPower(int level, int outputPin) {
     // currently no low power mode for SX1262 implemented, assuming PA boost
     
@@ -832,29 +1127,34 @@ void sx126x::optimizeModemSensitivity(){
     // todo: check if there's anything the sx1262 can do here
 }
 
-void sx126x::setSignalBandwidth(long sbw)
+uint8_t sx126x::bandwidthCode(long sbw)
 {
   if (sbw <= 7.8E3) {
-      _bw = 0x00;
+      return 0x00;
   } else if (sbw <= 10.4E3) {
-      _bw = 0x08;
+      return 0x08;
   } else if (sbw <= 15.6E3) {
-      _bw = 0x01;
+      return 0x01;
   } else if (sbw <= 20.8E3) {
-      _bw = 0x09;
+      return 0x09;
   } else if (sbw <= 31.25E3) {
-      _bw = 0x02;
+      return 0x02;
   } else if (sbw <= 41.7E3) {
-      _bw = 0x0A;
+      return 0x0A;
   } else if (sbw <= 62.5E3) {
-      _bw = 0x03;
+      return 0x03;
   } else if (sbw <= 125E3) {
-      _bw = 0x04;
+      return 0x04;
   } else if (sbw <= 250E3) {
-      _bw = 0x05;
+      return 0x05;
   } else /*if (sbw <= 250E3)*/ {
-      _bw = 0x06;
+      return 0x06;
   }
+}
+
+void sx126x::setSignalBandwidth(long sbw)
+{
+  _bw = bandwidthCode(sbw);
 
   handleLowDataRate();
   setModulationParams(_sf, _bw, _cr, _ldro);
@@ -883,13 +1183,49 @@ void sx126x::setPreambleLength(long length)
   setPacketParams(length, _implicitHeaderMode, _payloadLength, _crcMode);
 }
 
+void sx126x::applyConfig(const RadioConfig *config)
+{
+  // All parameters are stored first, so the
+  // modulation and packet parameters are only
+  // sent to the modem once
+  standby();
+
+  if (config->modulation <= MODULATION_GFSK && config->modulation != _modulation) {
+    _modulation = config->modulation;
+    setPacketType();
+  }
+
+  if (config->frequency != 0) {
+    calibrate_image(config->frequency);
+    setFrequency(config->frequency);
+  }
+
+  int sf = config->sf;
+  if (sf < 5) { sf = 5; } else if (sf > 12) { sf = 12; }
+  int cr = config->cr;
+  if (cr < 5) { cr = 5; } else if (cr > 8) { cr = 8; }
+
+  _sf = sf;
+  _cr = cr - 4;
+  _bw = bandwidthCode(config->bandwidth);
+  _preambleLength = config->preamble;
+  handleLowDataRate();
+
+  setModulationParams(_sf, _bw, _cr, _ldro);
+  setPacketParams(_preambleLength, _implicitHeaderMode, _payloadLength, _crcMode);
+
+  if (config->txp_pin != -1) setTxPower(config->txp, config->txp_pin);
+}
+
 void sx126x::setSyncWord(uint16_t sw)
 {
-  // TODO: Fix
-    // writeRegister(REG_SYNC_WORD_MSB_6X, (sw & 0xFF00) >> 8);
-    // writeRegister(REG_SYNC_WORD_LSB_6X, sw & 0x00FF);
-    writeRegister(REG_SYNC_WORD_MSB_6X, 0x14);
-    writeRegister(REG_SYNC_WORD_LSB_6X, 0x24);
+    _syncWord = sw;
+    writeRegister(REG_SYNC_WORD_MSB_6X, (sw & 0xFF00) >> 8);
+    writeRegister(REG_SYNC_WORD_LSB_6X, sw & 0x00FF);
+    if (_modulation == MODULATION_GFSK) {
+        writeRegister(REG_FSK_SYNC_WORD_6X+2, (sw & 0xFF00) >> 8);
+        writeRegister(REG_FSK_SYNC_WORD_6X+3, sw & 0x00FF);
+    }
 }
 
 void sx126x::enableCrc()
@@ -970,6 +1306,12 @@ void ISR_VECT sx126x::handleDio0Rise()
             _onReceive(packetLength);
         }
     }
+
+    // the modem leaves the RX duty cycle after
+    // a reception, so it is re-armed here
+    if (_rxDutyCycle) {
+        executeOpcode(OP_RX_DUTY_CYCLE_6X, _rxDutyParams, 6);
+    }
     // else {
     //   Serial.println("CRCE");
     //   Serial.println(buf[0]);
@@ -977,11 +1319,70 @@ void ISR_VECT sx126x::handleDio0Rise()
     // }
 }
 
-void ISR_VECT sx126x::onDio0Rise()
+uint32_t sx126x::rxTimestamp()
+{
+    return _rxTimestamp;
+}
+
+uint32_t sx126x::txTimestamp()
+{
+    return _txTimestamp;
+}
+
+void ISR_VECT sx126x::dio0Rise()
 {
-    sx126x_modem.handleDio0Rise();
+    // Timestamp the interrupt before any SPI
+    // traffic, so it tracks RX_DONE or TX_DONE
+    // as closely as possible
+    uint32_t timestamp = micros();
+    if (_txActive) {
+        _txTimestamp = timestamp;
+    } else {
+        _rxTimestamp = timestamp;
+        if (_onIrq) {
+            _onIrq();
+        } else {
+            handleDio0Rise();
+        }
+    }
 }
 
+// Interrupts are routed to the instance that
+// attached them, so more than one modem of
+// the same type can run on a board
+sx126x *sx126x::_instances[MODEM_INSTANCES] = { NULL, NULL };
+
+int8_t sx126x::attachInstance()
+{
+    for (int8_t i = 0; i < MODEM_INSTANCES; i++) {
+        if (_instances[i] == this) return i;
+    }
+    for (int8_t i = 0; i < MODEM_INSTANCES; i++) {
+        if (_instances[i] == NULL) { _instances[i] = this; return i; }
+    }
+    return -1;
+}
+
+void sx126x::detachInstance()
+{
+    for (int8_t i = 0; i < MODEM_INSTANCES; i++) {
+        if (_instances[i] == this) _instances[i] = NULL;
+    }
+}
+
+void ISR_VECT sx126x::onDio0Rise0()
+{
+    if (_instances[0]) _instances[0]->dio0Rise();
+}
+
+void ISR_VECT sx126x::onDio0Rise1()
+{
+    if (_instances[1]) _instances[1]->dio0Rise();
+}
+
+void (*const sx126x::_dio0Handlers[MODEM_INSTANCES])() = { sx126x::onDio0Rise0, sx126x::onDio0Rise1 };
+static_assert(MODEM_INSTANCES == 2, "one onDio0Rise trampoline is needed per instance");
+
 sx126x sx126x_modem;
 
 #endif
\ No newline at end of file
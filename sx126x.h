@@ -41,6 +41,8 @@ public:
   uint8_t packetSnrRaw();
   float packetSnr();
   long packetFrequencyError();
+  uint32_t rxTimestamp();
+  uint32_t txTimestamp();
 
   // from Print
   virtual size_t write(uint8_t byte);
@@ -53,9 +55,13 @@ public:
   virtual void flush();
 
   void onReceive(void(*callback)(int));
+  void onIrq(void(*callback)());
+  void handleIrq();
 
   void receive(int size = 0);
+  bool receiveDutyCycle(uint32_t rx_us, uint32_t sleep_us, int size = 0);
   void standby();
+  bool channelActivityDetect(int symbols);
   void sleep();
 
   bool preInit();
@@ -68,12 +74,17 @@ public:
   void setSignalBandwidth(long sbw);
   void setCodingRate4(int denominator);
   void setPreambleLength(long length);
+  void applyConfig(const RadioConfig *config);
   void setSyncWord(uint16_t sw);
   uint8_t modemStatus();
   void enableCrc();
   void disableCrc();
   void enableTCXO();
   void disableTCXO();
+  bool setModulation(uint8_t modulation);
+  uint8_t getModulation();
+  uint32_t getBitrate();
+  uint8_t maxPacketLength();
 
   void rxAntEnable();
   void loraMode();
@@ -99,6 +110,7 @@ public:
 
 private:
   void explicitHeaderMode();
+  void setPacketType();
   void implicitHeaderMode();
 
   void handleDio0Rise();
@@ -107,9 +119,15 @@ private:
   void writeRegister(uint16_t address, uint8_t value);
   uint8_t singleTransfer(uint8_t opcode, uint16_t address, uint8_t value);
 
-  static void onDio0Rise();
+  void dio0Rise();
+  int8_t attachInstance();
+  void detachInstance();
+
+  static void onDio0Rise0();
+  static void onDio0Rise1();
 
   void handleLowDataRate();
+  uint8_t bandwidthCode(long sbw);
   void optimizeModemSensitivity();
 
   void reset(void);
@@ -129,6 +147,10 @@ private:
   uint8_t _bw;
   uint8_t _cr;
   uint8_t _ldro;
+  uint8_t _modulation;
+  uint16_t _syncWord;
+  uint8_t _imageCal[2];
+  bool _imageCalValid;
   int _packetIndex;
   int _preambleLength;
   int _implicitHeaderMode;
@@ -138,7 +160,16 @@ private:
   int _fifo_rx_addr_ptr;
   uint8_t _packet[255];
   bool _preinit_done;
+  volatile uint32_t _rxTimestamp;
+  volatile uint32_t _txTimestamp;
+  volatile bool _txActive;
+  bool _rxDutyCycle;
+  uint8_t _rxDutyParams[6];
+  void (*_onIrq)();
   void (*_onReceive)(int);
+
+  static sx126x *_instances[MODEM_INSTANCES];
+  static void (*const _dio0Handlers[MODEM_INSTANCES])();
 };
 
 extern sx126x sx126x_modem;
@@ -64,6 +64,7 @@
 #define MODE_TX_7X                    0x03
 #define MODE_RX_CONTINUOUS_7X         0x05
 #define MODE_RX_SINGLE_7X             0x06
+#define MODE_CAD_7X                   0x07
 
 // PA config
 #define PA_BOOST_7X                   0x80
@@ -72,6 +73,8 @@
 #define IRQ_TX_DONE_MASK_7X           0x08
 #define IRQ_RX_DONE_MASK_7X           0x40
 #define IRQ_PAYLOAD_CRC_ERROR_MASK_7X 0x20
+#define IRQ_CAD_DONE_MASK_7X          0x04
+#define IRQ_CAD_DETECTED_MASK_7X      0x01
 
 #define SYNC_WORD_7X                  0x12
 #define MAX_PKT_LENGTH                255
@@ -84,6 +87,10 @@ sx127x::sx127x() :
   _frequency(0),
   _packetIndex(0),
   _preinit_done(false),
+  _rxTimestamp(0),
+  _txTimestamp(0),
+  _txActive(false),
+  _onIrq(NULL),
   _onReceive(NULL) { setTimeout(0); }
 
 void sx127x::setSPIFrequency(uint32_t frequency) { _spiSettings = SPISettings(frequency, MSBFIRST, SPI_MODE0); }
@@ -196,7 +203,12 @@ int sx127x::beginPacket(int implicitHeader) {
 }
 
 int sx127x::endPacket() {
+  // Map TX done to DIO0 while transmitting
+  if (_onReceive) { writeRegister(REG_DIO_MAPPING_1_7X, 0x40); }
+
   // Enter TX mode
+  _txTimestamp = 0;
+  _txActive = true;
   writeRegister(REG_OP_MODE_7X, MODE_LONG_RANGE_MODE_7X | MODE_TX_7X);
 
   // Wait for TX completion
@@ -204,8 +216,14 @@ int sx127x::endPacket() {
     yield();
   }
 
+  // Fall back to the polled time if the
+  // TX done interrupt was not captured
+  _txActive = false;
+  if (_txTimestamp == 0) { _txTimestamp = micros(); }
+
   // Clear TX complete IRQ
   writeRegister(REG_IRQ_FLAGS_7X, IRQ_TX_DONE_MASK_7X);
+  if (_onReceive) { writeRegister(REG_DIO_MAPPING_1_7X, 0x00); }
   return 1;
 }
 
@@ -314,10 +332,14 @@ void sx127x::onReceive(void(*callback)(int)) {
       SPI.usingInterrupt(digitalPinToInterrupt(_dio0));
     #endif
     
-    attachInterrupt(digitalPinToInterrupt(_dio0), sx127x::onDio0Rise, RISING);
+    // A modem beyond the available interrupt
+    // slots is left without an interrupt
+    int8_t instance = attachInstance();
+    if (instance >= 0) attachInterrupt(digitalPinToInterrupt(_dio0), _dio0Handlers[instance], RISING);
   
   } else {
     detachInterrupt(digitalPinToInterrupt(_dio0));
+    detachInstance();
     
     #ifdef SPI_HAS_NOTUSINGINTERRUPT
       SPI.notUsingInterrupt(digitalPinToInterrupt(_dio0));
@@ -325,6 +347,11 @@ void sx127x::onReceive(void(*callback)(int)) {
   }
 }
 
+// With an IRQ callback set, the ISR only timestamps
+// and signals, and handleIrq() must be run outside it
+void sx127x::onIrq(void(*callback)()) { _onIrq = callback; }
+void sx127x::handleIrq() { handleDio0Rise(); }
+
 void sx127x::receive(int size) {
   if (size > 0) {
     implicitHeaderMode();
@@ -334,6 +361,42 @@ void sx127x::receive(int size) {
   writeRegister(REG_OP_MODE_7X, MODE_LONG_RANGE_MODE_7X | MODE_RX_CONTINUOUS_7X);
 }
 
+bool sx127x::receiveDutyCycle(uint32_t rx_us, uint32_t sleep_us, int size) {
+  // No hardware RX duty cycle on this modem,
+  // the host MCU has to sniff with CAD instead
+  return false;
+}
+
+bool sx127x::channelActivityDetect(int symbols) {
+  // A single CAD cycle covers about two symbols,
+  // so longer windows are built from several
+  int sf = (readRegister(REG_MODEM_CONFIG_2_7X) >> 4);
+  uint32_t timeout_ms = ((uint32_t)(1 << sf) * 4 * 1000) / getSignalBandwidth() + 2;
+  int cycles = (symbols + 1) / 2;
+  if (cycles < 1) { cycles = 1; }
+
+  standby();
+
+  bool detected = false;
+  for (int i = 0; i < cycles && !detected; i++) {
+    writeRegister(REG_IRQ_FLAGS_7X, IRQ_CAD_DONE_MASK_7X | IRQ_CAD_DETECTED_MASK_7X);
+    writeRegister(REG_OP_MODE_7X, MODE_LONG_RANGE_MODE_7X | MODE_CAD_7X);
+
+    uint32_t started = millis();
+    uint8_t irqFlags = readRegister(REG_IRQ_FLAGS_7X);
+    while ((irqFlags & IRQ_CAD_DONE_MASK_7X) == 0 && millis() - started <= timeout_ms) {
+      yield();
+      irqFlags = readRegister(REG_IRQ_FLAGS_7X);
+    }
+
+    writeRegister(REG_IRQ_FLAGS_7X, IRQ_CAD_DONE_MASK_7X | IRQ_CAD_DETECTED_MASK_7X);
+    if (irqFlags & IRQ_CAD_DETECTED_MASK_7X) { detected = true; }
+  }
+
+  standby();
+  return detected;
+}
+
 void sx127x::setTxPower(int level, int outputPin) {
   // Setup according to RFO or PA_BOOST output pin
   if (PA_OUTPUT_RFO_PIN == outputPin) {
@@ -451,6 +514,19 @@ void sx127x::setPreambleLength(long length) {
   writeRegister(REG_PREAMBLE_LSB_7X, (uint8_t)(length >> 0));
 }
 
+void sx127x::applyConfig(const RadioConfig *config) {
+  // Each parameter has its own registers here,
+  // so the setters are simply applied in order,
+  // with the frequency first for the sensitivity
+  // optimisation that depends on it
+  if (config->frequency != 0) setFrequency(config->frequency);
+  setSignalBandwidth(config->bandwidth);
+  setSpreadingFactor(config->sf);
+  setCodingRate4(config->cr);
+  setPreambleLength(config->preamble);
+  if (config->txp_pin != -1) setTxPower(config->txp, config->txp_pin);
+}
+
 void sx127x::handleLowDataRate() {
   int sf = (readRegister(REG_MODEM_CONFIG_2_7X) >> 4);
   if ( long( (1<<sf) / (getSignalBandwidth()/1000)) > 16) {
@@ -491,7 +567,54 @@ void ISR_VECT sx127x::handleDio0Rise() {
   }
 }
 
-void ISR_VECT sx127x::onDio0Rise() { sx127x_modem.handleDio0Rise(); }
+uint32_t sx127x::rxTimestamp() { return _rxTimestamp; }
+uint32_t sx127x::txTimestamp() { return _txTimestamp; }
+
+void ISR_VECT sx127x::dio0Rise() {
+  // Timestamp the interrupt before any SPI
+  // traffic, so it tracks RX or TX done as
+  // closely as possible
+  uint32_t timestamp = micros();
+  if (_txActive) {
+    _txTimestamp = timestamp;
+  } else {
+    _rxTimestamp = timestamp;
+    if (_onIrq) { _onIrq(); }
+    else { handleDio0Rise(); }
+  }
+}
+
+// Interrupts are routed to the instance that
+// attached them, so more than one modem of
+// the same type can run on a board
+sx127x *sx127x::_instances[MODEM_INSTANCES] = { NULL, NULL };
+
+int8_t sx127x::attachInstance() {
+  for (int8_t i = 0; i < MODEM_INSTANCES; i++) {
+    if (_instances[i] == this) return i;
+  }
+  for (int8_t i = 0; i < MODEM_INSTANCES; i++) {
+    if (_instances[i] == NULL) { _instances[i] = this; return i; }
+  }
+  return -1;
+}
+
+void sx127x::detachInstance() {
+  for (int8_t i = 0; i < MODEM_INSTANCES; i++) {
+    if (_instances[i] == this) _instances[i] = NULL;
+  }
+}
+
+void ISR_VECT sx127x::onDio0Rise0() {
+  if (_instances[0]) _instances[0]->dio0Rise();
+}
+
+void ISR_VECT sx127x::onDio0Rise1() {
+  if (_instances[1]) _instances[1]->dio0Rise();
+}
+
+void (*const sx127x::_dio0Handlers[MODEM_INSTANCES])() = { sx127x::onDio0Rise0, sx127x::onDio0Rise1 };
+static_assert(MODEM_INSTANCES == 2, "one onDio0Rise trampoline is needed per instance");
 
 sx127x sx127x_modem;
 
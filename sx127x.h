@@ -39,6 +39,8 @@ public:
   uint8_t packetSnrRaw();
   float packetSnr();
   long packetFrequencyError();
+  uint32_t rxTimestamp();
+  uint32_t txTimestamp();
 
   // from Print
   virtual size_t write(uint8_t byte);
@@ -51,9 +53,13 @@ public:
   virtual void flush();
 
   void onReceive(void(*callback)(int));
+  void onIrq(void(*callback)());
+  void handleIrq();
 
   void receive(int size = 0);
+  bool receiveDutyCycle(uint32_t rx_us, uint32_t sleep_us, int size = 0);
   void standby();
+  bool channelActivityDetect(int symbols);
   void sleep();
 
   bool preInit();
@@ -66,6 +72,7 @@ public:
   void setSignalBandwidth(long sbw);
   void setCodingRate4(int denominator);
   void setPreambleLength(long length);
+  void applyConfig(const RadioConfig *config);
   void setSyncWord(uint8_t sw);
   uint8_t modemStatus();
   void enableCrc();
@@ -88,7 +95,12 @@ private:
   void writeRegister(uint8_t address, uint8_t value);
   uint8_t singleTransfer(uint8_t address, uint8_t value);
 
-  static void onDio0Rise();
+  void dio0Rise();
+  int8_t attachInstance();
+  void detachInstance();
+
+  static void onDio0Rise0();
+  static void onDio0Rise1();
 
   void handleLowDataRate();
   void optimizeModemSensitivity();
@@ -103,7 +115,14 @@ private:
   int _packetIndex;
   int _implicitHeaderMode;
   bool _preinit_done;
+  volatile uint32_t _rxTimestamp;
+  volatile uint32_t _txTimestamp;
+  volatile bool _txActive;
+  void (*_onIrq)();
   void (*_onReceive)(int);
+
+  static sx127x *_instances[MODEM_INSTANCES];
+  static void (*const _dio0Handlers[MODEM_INSTANCES])();
 };
 
 extern sx127x sx127x_modem;
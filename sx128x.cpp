@@ -67,14 +67,45 @@
 #define IRQ_PAYLOAD_CRC_ERROR_MASK_8X 0x40
 
 #define MODE_LONG_RANGE_MODE_8X     0x01
+#define MODE_GFSK_8X                0x00
+#define MODE_FLRC_8X                0x03
 
 #define OP_FIFO_WRITE_8X            0x1A
 #define OP_FIFO_READ_8X             0x1B
 #define IRQ_PREAMBLE_DET_MASK_8X    0x80
+#define IRQ_CAD_DONE_MASK_8X        0x10 // in the upper irq status byte
+#define IRQ_CAD_DETECTED_MASK_8X    0x20 // in the upper irq status byte
+
+#define OP_CAD_PARAMS_8X            0x88
+#define OP_CAD_8X                   0xC5
+#define OP_RX_DUTY_CYCLE_8X         0x94
 
 #define REG_PACKET_SIZE            0x901
 #define REG_FIRM_VER_MSB           0x154
 #define REG_FIRM_VER_LSB           0x153
+#define REG_FEI_MSB_8X             0x954
+#define REG_SYNC_WORD_1_8X         0x9CF // 4 byte sync word in GFSK and FLRC
+#define REG_LORA_SYNC_WORD_MSB_8X  0x944
+#define SYNC_WORD_8X               0x12
+
+#define IRQ_SYNC_VALID_MASK_8X      0x04
+#define FSK_MOD_IND_0_5_8X          0x01
+#define FSK_BT_0_5_8X               0x20
+#define FSK_PREAMBLE_32_BITS_8X     0x70
+#define GFSK_SYNC_LEN_4_8X          0x06
+#define FLRC_SYNC_LEN_4_8X          0x04
+#define FSK_SYNC_MATCH_1_8X         0x10
+#define FSK_VARIABLE_LENGTH_8X      0x20
+#define GFSK_CRC_2_BYTES_8X         0x20
+#define FLRC_CRC_2_BYTES_8X         0x10
+#define GFSK_WHITENING_ON_8X        0x00
+#define FLRC_WHITENING_OFF_8X       0x08
+#define FLRC_CR_1_2_8X              0x00
+#define FLRC_CR_3_4_8X              0x02
+#define FLRC_CR_1_0_8X              0x04
+#define FSK_ED_THRESHOLD            -95
+#define FSK_ED_SAMPLE_US            20
+#define FLRC_MAX_PKT_LENGTH         127
 
 #define XTAL_FREQ_8X (double)52000000
 #define FREQ_DIV_8X (double)pow(2.0, 18.0)
@@ -97,6 +128,8 @@ sx128x::sx128x() :
   _sf(0x50),
   _bw(0x34),
   _cr(0x01),
+  _modulation(MODULATION_LORA),
+  _syncWord(SYNC_WORD_8X),
   _packetIndex(0),
   _preambleLength(18),
   _implicitHeaderMode(0),
@@ -107,6 +140,11 @@ sx128x::sx128x() :
   _packet({0}),
   _rxPacketLength(0),
   _preinit_done(false),
+  _rxTimestamp(0),
+  _txTimestamp(0),
+  _txActive(false),
+  _rxDutyCycle(false),
+  _onIrq(NULL),
   _onReceive(NULL)
 {
   // overide Stream timeout value
@@ -200,8 +238,36 @@ void sx128x::txAntEnable()
 
 void sx128x::loraMode() {
     // enable lora mode on the SX1262 chip
+    _modulation = MODULATION_LORA;
+    setPacketType();
+}
+
+void sx128x::setPacketType() {
     uint8_t mode = MODE_LONG_RANGE_MODE_8X;
+    if (_modulation == MODULATION_GFSK) mode = MODE_GFSK_8X;
+    if (_modulation == MODULATION_FLRC) mode = MODE_FLRC_8X;
     executeOpcode(OP_PACKET_TYPE_8X, &mode, 1);
+
+    if (_modulation != MODULATION_LORA) {
+        // sync word shared by GFSK and FLRC,
+        // ending in the LoRa sync word
+        writeRegister(REG_SYNC_WORD_1_8X+0, 0x52);
+        writeRegister(REG_SYNC_WORD_1_8X+1, 0x4E);
+        writeRegister(REG_SYNC_WORD_1_8X+2, 0x4F);
+        writeRegister(REG_SYNC_WORD_1_8X+3, _syncWord);
+    }
+}
+
+uint8_t sx128x::fskBitrateBandwidth() {
+    // Each LoRa bandwidth maps to the GFSK or FLRC
+    // setting with the closest occupied bandwidth,
+    // and both modes happen to share the codes
+    switch (_bw) {
+        case 0x34: return (_modulation == MODULATION_FLRC) ? 0xEB : 0xEF;
+        case 0x26: return 0xC7;
+        case 0x18: return 0x86;
+        default:   return 0x45;
+    }
 }
 
 void sx128x::waitOnBusy() {
@@ -303,6 +369,24 @@ void sx128x::setModulationParams(uint8_t sf, uint8_t bw, uint8_t cr) {
   // to set all these parameters at once or not at all.
   uint8_t buf[3];
 
+  if (_modulation != MODULATION_LORA) {
+      buf[0] = fskBitrateBandwidth();
+      if (_modulation == MODULATION_FLRC) {
+          if (cr <= 1) {
+              buf[1] = FLRC_CR_1_0_8X;
+          } else if (cr == 2) {
+              buf[1] = FLRC_CR_3_4_8X;
+          } else {
+              buf[1] = FLRC_CR_1_2_8X;
+          }
+      } else {
+          buf[1] = FSK_MOD_IND_0_5_8X;
+      }
+      buf[2] = FSK_BT_0_5_8X;
+      executeOpcode(OP_MODULATION_PARAMS_8X, buf, 3);
+      return;
+  }
+
   buf[0] = sf;
   buf[1] = bw;
   buf[2] = cr; 
@@ -323,6 +407,25 @@ void sx128x::setPacketParams(uint32_t preamble, uint8_t headermode, uint8_t leng
   // to set all these parameters at once or not at all.
   uint8_t buf[7];
 
+  if (_modulation != MODULATION_LORA) {
+      // the GFSK and FLRC preamble is counted in
+      // bits, and is always set to the maximum
+      bool flrc = (_modulation == MODULATION_FLRC);
+      buf[0] = FSK_PREAMBLE_32_BITS_8X;
+      buf[1] = flrc ? FLRC_SYNC_LEN_4_8X : GFSK_SYNC_LEN_4_8X;
+      buf[2] = FSK_SYNC_MATCH_1_8X;
+      buf[3] = headermode ? 0x00 : FSK_VARIABLE_LENGTH_8X;
+      buf[4] = length;
+      if (crc) {
+          buf[5] = flrc ? FLRC_CRC_2_BYTES_8X : GFSK_CRC_2_BYTES_8X;
+      } else {
+          buf[5] = 0x00;
+      }
+      buf[6] = flrc ? FLRC_WHITENING_OFF_8X : GFSK_WHITENING_ON_8X;
+      executeOpcode(OP_PACKET_PARAMS_8X, buf, 7);
+      return;
+  }
+
   // calculate exponent and mantissa values for modem
   uint8_t e = 1;
   uint8_t m = 1;
@@ -380,7 +483,7 @@ int sx128x::begin(unsigned long frequency)
   }
 
   idle();
-  loraMode();
+  setPacketType();
   rxAntEnable();
 
   setFrequency(frequency);
@@ -438,6 +541,8 @@ int sx128x::endPacket()
   txAntEnable();
 
   // put in single TX mode
+  _txTimestamp = 0;
+  _txActive = true;
   uint8_t timeout[3] = {0};
   executeOpcode(OP_TX_8X, timeout, 3);
 
@@ -456,6 +561,11 @@ int sx128x::endPacket()
     yield();
   }
 
+  // fall back to the polled time if the
+  // TX_DONE interrupt was not captured
+  _txActive = false;
+  if (_txTimestamp == 0) _txTimestamp = micros();
+
   // clear IRQ's
 
   uint8_t mask[2];
@@ -481,7 +591,12 @@ uint8_t sx128x::modemStatus() {
         clearbuf[0] = 0xFF;
     }
 
-    if ((buf[1] & IRQ_HEADER_DET_MASK_8X) != 0) {
+    // GFSK and FLRC have no header, but a valid
+    // sync word is just as good an indicator
+    uint8_t header_mask = IRQ_HEADER_DET_MASK_8X;
+    if (_modulation != MODULATION_LORA) header_mask = IRQ_SYNC_VALID_MASK_8X;
+
+    if ((buf[1] & header_mask) != 0) {
         byte = byte | 0x02 | 0x04;
         // clear register after reading
         clearbuf[1] = 0xFF;
@@ -509,6 +624,7 @@ int ISR_VECT sx128x::currentRssi() {
 uint8_t sx128x::packetRssiRaw() {
     uint8_t buf[5] = {0};
     executeOpcodeRead(OP_PACKET_STATUS_8X, buf, 5);
+    if (_modulation != MODULATION_LORA) return buf[1];
     return buf[0];
 }
 
@@ -516,17 +632,23 @@ int ISR_VECT sx128x::packetRssi() {
     // may need more calculations here
     uint8_t buf[5] = {0};
     executeOpcodeRead(OP_PACKET_STATUS_8X, buf, 5);
+    // GFSK and FLRC report the RSSI at sync
+    // in the second byte of the packet status
+    if (_modulation != MODULATION_LORA) buf[0] = buf[1];
     int pkt_rssi = -buf[0] / 2;
     return pkt_rssi;
 }
 
 uint8_t ISR_VECT sx128x::packetSnrRaw() {
+    // there is no SNR estimate outside LoRa mode
+    if (_modulation != MODULATION_LORA) return 0;
     uint8_t buf[5] = {0};
     executeOpcodeRead(OP_PACKET_STATUS_8X, buf, 5);
     return buf[1];
 }
 
 float ISR_VECT sx128x::packetSnr() {
+    if (_modulation != MODULATION_LORA) return 0.0;
     uint8_t buf[5] = {0};
     executeOpcodeRead(OP_PACKET_STATUS_8X, buf, 3);
     return float(buf[1]) * 0.25;
@@ -534,9 +656,23 @@ float ISR_VECT sx128x::packetSnr() {
 
 long sx128x::packetFrequencyError()
 {
+  // The LoRa frequency error indicator is a
+  // 20-bit signed value, see page 120 of the
+  // sx1280 datasheet
+  if (_modulation != MODULATION_LORA) return 0;
   int32_t freqError = 0;
-  // todo: implement this, page 120 of sx1280 datasheet
-  const float fError = 0.0;
+  freqError = static_cast<int32_t>(readRegister(REG_FEI_MSB_8X) & 0x0F);
+  freqError <<= 8L;
+  freqError += static_cast<int32_t>(readRegister(REG_FEI_MSB_8X+1));
+  freqError <<= 8L;
+  freqError += static_cast<int32_t>(readRegister(REG_FEI_MSB_8X+2));
+
+  if (freqError & 0x80000) { // Sign bit is on
+      freqError -= 1048576;
+  }
+
+  const float fError = 1.55f * static_cast<float>(freqError) / (1600.0f / (getSignalBandwidth() / 1000.0f));
+
   return static_cast<long>(fError);
 }
 
@@ -547,8 +683,8 @@ size_t sx128x::write(uint8_t byte)
 
 size_t sx128x::write(const uint8_t *buffer, size_t size)
 {
-  if ((_payloadLength + size) > MAX_PKT_LENGTH) {
-      size = MAX_PKT_LENGTH - _payloadLength;
+  if ((_payloadLength + size) > maxPacketLength()) {
+      size = maxPacketLength() - _payloadLength;
   }
 
   // write data
@@ -603,7 +739,7 @@ void sx128x::onReceive(void(*callback)(int))
 
       // set dio0 masks
       buf[2] = 0x00;
-      buf[3] = IRQ_RX_DONE_MASK_8X; 
+      buf[3] = IRQ_RX_DONE_MASK_8X | IRQ_TX_DONE_MASK_8X;
 
       // set dio1 masks
       buf[4] = 0x00; 
@@ -617,17 +753,36 @@ void sx128x::onReceive(void(*callback)(int))
 //#ifdef SPI_HAS_NOTUSINGINTERRUPT
 //    SPI.usingInterrupt(digitalPinToInterrupt(_dio0));
 //#endif
-    attachInterrupt(digitalPinToInterrupt(_dio0), sx128x::onDio0Rise, RISING);
+    // A modem beyond the available interrupt
+    // slots is left without an interrupt
+    int8_t instance = attachInstance();
+    if (instance >= 0) attachInterrupt(digitalPinToInterrupt(_dio0), _dio0Handlers[instance], RISING);
   } else {
     detachInterrupt(digitalPinToInterrupt(_dio0));
+    detachInstance();
 //#ifdef SPI_HAS_NOTUSINGINTERRUPT
 //    SPI.notUsingInterrupt(digitalPinToInterrupt(_dio0));
 //#endif
   }
 }
 
+void sx128x::onIrq(void(*callback)())
+{
+  // With an IRQ callback set, the ISR only
+  // timestamps and signals, and the caller
+  // must run handleIrq() outside the ISR
+  _onIrq = callback;
+}
+
+void sx128x::handleIrq()
+{
+  handleDio0Rise();
+}
+
 void sx128x::receive(int size)
 {
+  _rxDutyCycle = false;
+
   if (size > 0) {
     implicitHeaderMode();
 
@@ -645,6 +800,100 @@ void sx128x::receive(int size)
     executeOpcode(OP_RX_8X, mode, 3);
 }
 
+bool sx128x::receiveDutyCycle(uint32_t rx_us, uint32_t sleep_us, int size)
+{
+  // the 32 bit GFSK and FLRC preamble is far too
+  // short for a sleeping receiver to catch, so
+  // the firmware keeps them in continuous receive
+  if (_modulation != MODULATION_LORA) return false;
+
+  if (size > 0) {
+    implicitHeaderMode();
+
+    // tell radio payload length
+    _rxPacketLength = size;
+  } else {
+    explicitHeaderMode();
+  }
+
+  idle();
+
+  rxAntEnable();
+
+  // use the finest period base that fits both
+  // periods, starting from 15.625 us steps
+  uint8_t base = 0x00;
+  uint32_t rx_count = (rx_us * 8) / 125;
+  uint32_t sleep_count = (sleep_us * 8) / 125;
+  while (base < 0x03 && (rx_count > 0xFFFF || sleep_count > 0xFFFF)) {
+    base++;
+    uint8_t div = (base == 0x02) ? 16 : 4;
+    rx_count /= div;
+    sleep_count /= div;
+  }
+  if (rx_count > 0xFFFF) rx_count = 0xFFFF;
+  if (sleep_count > 0xFFFF) sleep_count = 0xFFFF;
+
+  _rxDutyParams[0] = base;
+  _rxDutyParams[1] = (rx_count >> 8) & 0xFF;
+  _rxDutyParams[2] = rx_count & 0xFF;
+  _rxDutyParams[3] = (sleep_count >> 8) & 0xFF;
+  _rxDutyParams[4] = sleep_count & 0xFF;
+
+  _rxDutyCycle = true;
+  executeOpcode(OP_RX_DUTY_CYCLE_8X, _rxDutyParams, 5);
+  return true;
+}
+
+bool sx128x::channelActivityDetect(int symbols)
+{
+  if (_modulation != MODULATION_LORA) {
+    // There is no CAD outside LoRa mode, so the
+    // channel is sampled for energy instead
+    rxAntEnable();
+    uint8_t mode[3] = {0x00, 0x00, 0x00};
+    executeOpcode(OP_RX_8X, mode, 3);
+    bool detected = false;
+    for (int i = 0; i < symbols && !detected; i++) {
+      delayMicroseconds(FSK_ED_SAMPLE_US);
+      if (currentRssi() > FSK_ED_THRESHOLD) detected = true;
+    }
+    return detected;
+  }
+
+  idle();
+
+  rxAntEnable();
+
+  // CAD length can be 1, 2, 4, 8 or 16 symbols
+  uint8_t cad_symbols = 0x00;
+  while (cad_symbols < 0x04 && (1 << cad_symbols) < symbols) { cad_symbols++; }
+
+  uint8_t buf[1];
+  buf[0] = cad_symbols << 5;
+  executeOpcode(OP_CAD_PARAMS_8X, buf, 1);
+  executeOpcode(OP_CAD_8X, buf, 0);
+
+  // wait for CAD done, with a timeout of a few
+  // symbols beyond the detection window
+  uint32_t timeout_ms = ((uint32_t)(1 << (_sf >> 4)) * ((1 << cad_symbols) + 2) * 1000) / getSignalBandwidth() + 2;
+  uint32_t started = millis();
+
+  uint8_t irq[2] = {0};
+  executeOpcodeRead(OP_GET_IRQ_STATUS_8X, irq, 2);
+  while ((irq[0] & IRQ_CAD_DONE_MASK_8X) == 0 && millis() - started <= timeout_ms) {
+    yield();
+    executeOpcodeRead(OP_GET_IRQ_STATUS_8X, irq, 2);
+  }
+
+  uint8_t mask[2];
+  mask[0] = IRQ_CAD_DONE_MASK_8X | IRQ_CAD_DETECTED_MASK_8X;
+  mask[1] = 0x00;
+  executeOpcode(OP_CLEAR_IRQ_STATUS_8X, mask, 2);
+
+  return (irq[0] & IRQ_CAD_DONE_MASK_8X) && (irq[0] & IRQ_CAD_DETECTED_MASK_8X);
+}
+
 void sx128x::idle()
 {
       #if HAS_TCXO
@@ -663,6 +912,56 @@ void sx128x::sleep()
     executeOpcode(OP_SLEEP_8X, &byte, 1);
 }
 
+bool sx128x::setModulation(uint8_t modulation) {
+  if (modulation > MODULATION_FLRC) return false;
+
+  // Switching packet type resets the modem
+  // configuration, so all of it is re-applied
+  _modulation = modulation;
+  idle();
+  setPacketType();
+  if (_frequency != 0) setFrequency(_frequency);
+  setModulationParams(_sf, _bw, _cr);
+  setPacketParams(_preambleLength, _implicitHeaderMode, _payloadLength, _crcMode);
+  setTxPower(_txp);
+  return true;
+}
+
+uint8_t sx128x::getModulation() {
+  return _modulation;
+}
+
+uint32_t sx128x::getBitrate() {
+  // Net bitrate in GFSK and FLRC modes, the
+  // LoRa bitrate is derived by the caller
+  uint8_t brbw = fskBitrateBandwidth();
+  if (_modulation == MODULATION_GFSK) {
+    switch (brbw) {
+      case 0xEF: return 125000;
+      case 0xC7: return 250000;
+      case 0x86: return 500000;
+      default:   return 1000000;
+    }
+  } else if (_modulation == MODULATION_FLRC) {
+    uint32_t gross;
+    switch (brbw) {
+      case 0xEB: gross = 260000; break;
+      case 0xC7: gross = 325000; break;
+      case 0x86: gross = 650000; break;
+      default:   gross = 1300000; break;
+    }
+    if (_cr <= 1) return gross;
+    if (_cr == 2) return gross*3/4;
+    return gross/2;
+  }
+  return 0;
+}
+
+uint8_t sx128x::maxPacketLength() {
+  if (_modulation == MODULATION_FLRC) return FLRC_MAX_PKT_LENGTH;
+  return MAX_PKT_LENGTH;
+}
+
 void sx128x::enableTCXO() {
     // todo: need to check how to implement on sx1280
 }
@@ -750,17 +1049,22 @@ void sx128x::optimizeModemSensitivity(){
     // todo: check if there's anything the sx1280 can do here
 }
 
-void sx128x::setSignalBandwidth(long sbw)
+uint8_t sx128x::bandwidthCode(long sbw)
 {
       if (sbw <= 203.125E3) {
-          _bw = 0x34;
+          return 0x34;
       } else if (sbw <= 406.25E3) {
-          _bw = 0x26;
+          return 0x26;
       } else if (sbw <= 812.5E3) {
-          _bw = 0x18;
+          return 0x18;
       } else {
-          _bw = 0x0A;
+          return 0x0A;
       }
+}
+
+void sx128x::setSignalBandwidth(long sbw)
+{
+      _bw = bandwidthCode(sbw);
 
       setModulationParams(_sf, _bw, _cr);
 
@@ -792,9 +1096,46 @@ void sx128x::setPreambleLength(long length)
   setPacketParams(length, _implicitHeaderMode, _payloadLength, _crcMode);
 }
 
+void sx128x::applyConfig(const RadioConfig *config)
+{
+  // All parameters are stored first, so the
+  // modulation and packet parameters are only
+  // sent to the modem once
+  idle();
+
+  if (config->modulation <= MODULATION_FLRC && config->modulation != _modulation) {
+    _modulation = config->modulation;
+    setPacketType();
+  }
+
+  if (config->frequency != 0) setFrequency(config->frequency);
+
+  int sf = config->sf;
+  if (sf < 5) { sf = 5; } else if (sf > 12) { sf = 12; }
+  int cr = config->cr;
+  if (cr < 5) { cr = 5; } else if (cr > 8) { cr = 8; }
+
+  _sf = sf << 4;
+  _cr = cr - 4;
+  _bw = bandwidthCode(config->bandwidth);
+  _preambleLength = config->preamble;
+
+  setModulationParams(_sf, _bw, _cr);
+  setPacketParams(_preambleLength, _implicitHeaderMode, _payloadLength, _crcMode);
+
+  if (config->txp_pin != -1) setTxPower(config->txp, config->txp_pin);
+}
+
 void sx128x::setSyncWord(int sw)
 {
-    // not implemented
+    // The LoRa sync word nibbles sit in the
+    // upper half of two adjacent registers
+    _syncWord = sw;
+    uint8_t msb = readRegister(REG_LORA_SYNC_WORD_MSB_8X);
+    uint8_t lsb = readRegister(REG_LORA_SYNC_WORD_MSB_8X+1);
+    writeRegister(REG_LORA_SYNC_WORD_MSB_8X, (msb & 0x0F) | (sw & 0xF0));
+    writeRegister(REG_LORA_SYNC_WORD_MSB_8X+1, (lsb & 0x0F) | ((sw & 0x0F) << 4));
+    if (_modulation != MODULATION_LORA) writeRegister(REG_SYNC_WORD_1_8X+3, _syncWord);
 }
 
 void sx128x::enableCrc()
@@ -879,11 +1220,76 @@ void ISR_VECT sx128x::handleDio0Rise()
         }
 
     }
+
+    // the modem leaves the RX duty cycle after
+    // a reception, so it is re-armed here
+    if (_rxDutyCycle) {
+        executeOpcode(OP_RX_DUTY_CYCLE_8X, _rxDutyParams, 5);
+    }
 }
 
-void ISR_VECT sx128x::onDio0Rise()
+uint32_t sx128x::rxTimestamp()
 {
-  sx128x_modem.handleDio0Rise();
+  return _rxTimestamp;
 }
 
+uint32_t sx128x::txTimestamp()
+{
+  return _txTimestamp;
+}
+
+void ISR_VECT sx128x::dio0Rise()
+{
+  // Timestamp the interrupt before any SPI
+  // traffic, so it tracks RX_DONE or TX_DONE
+  // as closely as possible
+  uint32_t timestamp = micros();
+  if (_txActive) {
+    _txTimestamp = timestamp;
+  } else {
+    _rxTimestamp = timestamp;
+    if (_onIrq) {
+      _onIrq();
+    } else {
+      handleDio0Rise();
+    }
+  }
+}
+
+// Interrupts are routed to the instance that
+// attached them, so more than one modem of
+// the same type can run on a board
+sx128x *sx128x::_instances[MODEM_INSTANCES] = { NULL, NULL };
+
+int8_t sx128x::attachInstance()
+{
+  for (int8_t i = 0; i < MODEM_INSTANCES; i++) {
+    if (_instances[i] == this) return i;
+  }
+  for (int8_t i = 0; i < MODEM_INSTANCES; i++) {
+    if (_instances[i] == NULL) { _instances[i] = this; return i; }
+  }
+  return -1;
+}
+
+void sx128x::detachInstance()
+{
+  for (int8_t i = 0; i < MODEM_INSTANCES; i++) {
+    if (_instances[i] == this) _instances[i] = NULL;
+  }
+}
+
+void ISR_VECT sx128x::onDio0Rise0()
+{
+  if (_instances[0]) _instances[0]->dio0Rise();
+}
+
+void ISR_VECT sx128x::onDio0Rise1()
+{
+  if (_instances[1]) _instances[1]->dio0Rise();
+}
+
+void (*const sx128x::_dio0Handlers[MODEM_INSTANCES])() = { sx128x::onDio0Rise0, sx128x::onDio0Rise1 };
+static_assert(MODEM_INSTANCES == 2, "one onDio0Rise trampoline is needed per instance");
+
 sx128x sx128x_modem;
@@ -41,6 +41,8 @@ public:
   uint8_t packetSnrRaw();
   float packetSnr();
   long packetFrequencyError();
+  uint32_t rxTimestamp();
+  uint32_t txTimestamp();
 
   // from Print
   virtual size_t write(uint8_t byte);
@@ -53,9 +55,13 @@ public:
   virtual void flush();
 
   void onReceive(void(*callback)(int));
+  void onIrq(void(*callback)());
+  void handleIrq();
 
   void receive(int size = 0);
+  bool receiveDutyCycle(uint32_t rx_us, uint32_t sleep_us, int size = 0);
   void idle();
+  bool channelActivityDetect(int symbols);
   void sleep();
 
   bool preInit();
@@ -68,12 +74,17 @@ public:
   void setSignalBandwidth(long sbw);
   void setCodingRate4(int denominator);
   void setPreambleLength(long length);
+  void applyConfig(const RadioConfig *config);
   void setSyncWord(int sw);
   uint8_t modemStatus();
   void enableCrc();
   void disableCrc();
   void enableTCXO();
   void disableTCXO();
+  bool setModulation(uint8_t modulation);
+  uint8_t getModulation();
+  uint32_t getBitrate();
+  uint8_t maxPacketLength();
 
   void txAntEnable();
   void rxAntEnable();
@@ -100,6 +111,8 @@ public:
 private:
   void explicitHeaderMode();
   void implicitHeaderMode();
+  void setPacketType();
+  uint8_t fskBitrateBandwidth();
 
   void handleDio0Rise();
 
@@ -107,9 +120,15 @@ private:
   void writeRegister(uint16_t address, uint8_t value);
   uint8_t singleTransfer(uint8_t opcode, uint16_t address, uint8_t value);
 
-  static void onDio0Rise();
+  void dio0Rise();
+  int8_t attachInstance();
+  void detachInstance();
+
+  static void onDio0Rise0();
+  static void onDio0Rise1();
 
   void handleLowDataRate();
+  uint8_t bandwidthCode(long sbw);
   void optimizeModemSensitivity();
 
 private:
@@ -126,6 +145,8 @@ private:
   uint8_t _sf;
   uint8_t _bw;
   uint8_t _cr;
+  uint8_t _modulation;
+  uint8_t _syncWord;
   int _packetIndex;
   uint32_t _preambleLength;
   int _implicitHeaderMode;
@@ -136,7 +157,16 @@ private:
   uint8_t _packet[256];
   bool _preinit_done;
   int _rxPacketLength;
+  volatile uint32_t _rxTimestamp;
+  volatile uint32_t _txTimestamp;
+  volatile bool _txActive;
+  bool _rxDutyCycle;
+  uint8_t _rxDutyParams[5];
+  void (*_onIrq)();
   void (*_onReceive)(int);
+
+  static sx128x *_instances[MODEM_INSTANCES];
+  static void (*const _dio0Handlers[MODEM_INSTANCES])();
 };
 
 extern sx128x sx128x_modem;